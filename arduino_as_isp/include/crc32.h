@@ -0,0 +1,31 @@
+/// @file crc32.h
+/// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320) of the on-programmer verification. The sketch computes
+/// it over the memory of the target, the host tool `tools/isp_verify.cpp` over the image, both with this code.
+/// Bitwise, no table: ~100 cycles per byte are far below the time of reading the byte over SPI.
+/// @author JF
+/// @date May 10, 2023
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+/// Start value, the final crc is the complement of the running value.
+#define CRC32_INITIAL 0xFFFFFFFFlu
+
+/// Continue the crc over a block.
+///
+/// @param crc The running crc, @ref CRC32_INITIAL to start.
+/// @param data The block.
+/// @param length The size of the block.
+/// @return The running crc.
+static inline uint32_t crc32_update(uint32_t crc, const uint8_t* data, uint16_t length) {
+    while (length-- > 0u) {
+        crc ^= *data++;
+        for (uint8_t bit = 0u; bit < 8u; bit++) {
+            crc = (crc >> 1u) ^ ((crc & 1u) ? 0xEDB88320lu : 0u);
+        }
+    }
+    return crc;
+}
+
+#endif // CRC32_H
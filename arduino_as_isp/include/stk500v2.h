@@ -0,0 +1,510 @@
+/// @file stk500v2.h
+/// Hardware independent STK500v2 protocol engine of the ArduinoISP (Atmel AN AVR068): message framing with
+/// checksum and the ISP commands of avrdude `-c stk500v2`. A message carries up to 275 bytes and the address
+/// is incremented by the memory commands, so a page costs one round trip instead of two with STK500v1.
+///
+/// The includer provides the access to the target with the functions declared at the end, the sketch with its
+/// SPI and programming mode code, the host simulator in `tools/stk500v2_sim.cpp` with a modelled target.
+/// @author JF
+/// @date May 10, 2023
+#ifndef STK500V2_H
+#define STK500V2_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Message framing.
+#define STK500V2_MESSAGE_START 0x1Bu
+#define STK500V2_TOKEN 0x0Eu
+#define STK500V2_HEADER_SIZE 5u
+
+/// The maximum message body. Also the size of the message buffer.
+#define STK500V2_BODY_MAX 275u
+
+/// General commands.
+#define STK500V2_CMD_SIGN_ON 0x01u
+#define STK500V2_CMD_SET_PARAMETER 0x02u
+#define STK500V2_CMD_GET_PARAMETER 0x03u
+#define STK500V2_CMD_LOAD_ADDRESS 0x06u
+
+/// ISP commands.
+#define STK500V2_CMD_ENTER_PROGMODE_ISP 0x10u
+#define STK500V2_CMD_LEAVE_PROGMODE_ISP 0x11u
+#define STK500V2_CMD_CHIP_ERASE_ISP 0x12u
+#define STK500V2_CMD_PROGRAM_FLASH_ISP 0x13u
+#define STK500V2_CMD_READ_FLASH_ISP 0x14u
+#define STK500V2_CMD_PROGRAM_EEPROM_ISP 0x15u
+#define STK500V2_CMD_READ_EEPROM_ISP 0x16u
+#define STK500V2_CMD_PROGRAM_FUSE_ISP 0x17u
+#define STK500V2_CMD_READ_FUSE_ISP 0x18u
+#define STK500V2_CMD_PROGRAM_LOCK_ISP 0x19u
+#define STK500V2_CMD_READ_LOCK_ISP 0x1Au
+#define STK500V2_CMD_READ_SIGNATURE_ISP 0x1Bu
+#define STK500V2_CMD_READ_OSCCAL_ISP 0x1Cu
+#define STK500V2_CMD_SPI_MULTI 0x1Du
+
+/// Answer to a message with a wrong checksum.
+#define STK500V2_ANSWER_CKSUM_ERROR 0xB0u
+
+/// Status codes.
+#define STK500V2_STATUS_CMD_OK 0x00u
+#define STK500V2_STATUS_RDY_BSY_TOUT 0x81u
+#define STK500V2_STATUS_CMD_FAILED 0xC0u
+#define STK500V2_STATUS_CKSUM_ERROR 0xC1u
+#define STK500V2_STATUS_CMD_UNKNOWN 0xC9u
+
+/// Parameters, stored in @ref stk500v2_session_t from 0x80 to 0x9F.
+#define STK500V2_PARAM_FIRST 0x80u
+#define STK500V2_PARAM_COUNT 0x20u
+#define STK500V2_PARAM_HW_VER 0x90u
+#define STK500V2_PARAM_SW_MAJOR 0x91u
+#define STK500V2_PARAM_SW_MINOR 0x92u
+#define STK500V2_PARAM_VTARGET 0x94u
+#define STK500V2_PARAM_RESET_POLARITY 0x9Eu
+
+/// Vendor parameters: blank flash pages skipped since entering programming mode and the time saved in ms,
+/// the latter is filled in by the includer.
+#define STK500V2_PARAM_BLANK_PAGES_LOW 0x8Au
+#define STK500V2_PARAM_BLANK_PAGES_HIGH 0x8Bu
+#define STK500V2_PARAM_SAVED_MS_LOW 0x8Cu
+#define STK500V2_PARAM_SAVED_MS_HIGH 0x8Du
+
+/// Mode byte of the program flash/eeprom commands: page mode, write the page at the end.
+#define STK500V2_MODE_PAGE 0x01u
+#define STK500V2_MODE_WRITE_PAGE 0x80u
+
+/// Result of @ref stk500v2_receive.
+typedef enum stk500v2_results {
+    STK500V2_RECEIVING,
+    STK500V2_MESSAGE,
+    STK500V2_CHECKSUM_ERROR
+} stk500v2_results_t;
+
+/// The states of the message parser.
+typedef enum stk500v2_states {
+    STK500V2_STATE_START,
+    STK500V2_STATE_SEQUENCE,
+    STK500V2_STATE_SIZE_HIGH,
+    STK500V2_STATE_SIZE_LOW,
+    STK500V2_STATE_TOKEN,
+    STK500V2_STATE_BODY,
+    STK500V2_STATE_CHECKSUM
+} stk500v2_states_t;
+
+/// The message parser.
+typedef struct stk500v2_parser {
+    uint8_t state;
+    uint8_t sequence;
+    uint16_t size;
+    uint16_t index;
+    uint8_t checksum;
+} stk500v2_parser_t;
+
+/// The state kept between the commands.
+typedef struct stk500v2_session {
+    /// Address of the next flash (word) or eeprom (byte) access, set by @ref STK500V2_CMD_LOAD_ADDRESS.
+    uint32_t address;
+
+    /// The parameters set by the host.
+    uint8_t parameters[STK500V2_PARAM_COUNT];
+} stk500v2_session_t;
+
+/// Transfer a byte to the target and get the byte shifted out by it.
+///
+/// @param data The byte sent.
+/// @return The byte received.
+uint8_t stk500v2_isp_transfer(uint8_t data);
+
+/// Reset the target and enter its programming mode.
+///
+/// @param session The session, its reset polarity parameter is used.
+/// @return True if the target is in sync.
+bool stk500v2_isp_enter(const stk500v2_session_t* session);
+
+/// Release the target from reset.
+void stk500v2_isp_leave(void);
+
+/// Poll the RDY/BSY flag of the target until it is ready.
+///
+/// @param flash_page True after a flash page write, its duration estimates the time a skipped blank page saves.
+/// @return False on timeout.
+bool stk500v2_isp_wait_ready(bool flash_page);
+
+/// Wait.
+///
+/// @param ms The time in ms.
+void stk500v2_delay_ms(uint8_t ms);
+
+/// Reset the parser, e.g. after a timeout between two bytes of a message.
+///
+/// @param parser The parser.
+static inline void stk500v2_reset(stk500v2_parser_t* parser) {
+    parser->state = STK500V2_STATE_START;
+}
+
+/// Set up a new session.
+///
+/// @param session The session.
+static inline void stk500v2_init(stk500v2_session_t* session) {
+    session->address = 0u;
+    for (uint8_t index = 0u; index < STK500V2_PARAM_COUNT; index++) {
+        session->parameters[index] = 0u;
+    }
+    session->parameters[STK500V2_PARAM_HW_VER - STK500V2_PARAM_FIRST] = 2u;
+    session->parameters[STK500V2_PARAM_SW_MAJOR - STK500V2_PARAM_FIRST] = 2u;
+    session->parameters[STK500V2_PARAM_SW_MINOR - STK500V2_PARAM_FIRST] = 10u;
+
+    // Not measured, the target is assumed to run at 5.0V.
+    session->parameters[STK500V2_PARAM_VTARGET - STK500V2_PARAM_FIRST] = 50u;
+
+    // 1: active low reset (AVR), 0: active high (AT89Sx).
+    session->parameters[STK500V2_PARAM_RESET_POLARITY - STK500V2_PARAM_FIRST] = 1u;
+}
+
+/// Feed a received byte into the parser. Bytes outside of a message are dropped, as is a message that
+/// doesn't fit into the buffer.
+///
+/// @param parser The parser.
+/// @param body The message buffer, @ref STK500V2_BODY_MAX bytes.
+/// @param data The received byte.
+/// @return @ref STK500V2_MESSAGE once a complete message with correct checksum is in the buffer.
+static inline uint8_t stk500v2_receive(stk500v2_parser_t* parser, uint8_t* body, uint8_t data) {
+    parser->checksum ^= data;
+
+    switch (parser->state) {
+    case STK500V2_STATE_START:
+        if (data == STK500V2_MESSAGE_START) {
+            parser->checksum = data;
+            parser->state = STK500V2_STATE_SEQUENCE;
+        }
+        break;
+    case STK500V2_STATE_SEQUENCE:
+        parser->sequence = data;
+        parser->state = STK500V2_STATE_SIZE_HIGH;
+        break;
+    case STK500V2_STATE_SIZE_HIGH:
+        parser->size = (uint16_t)data << 8u;
+        parser->state = STK500V2_STATE_SIZE_LOW;
+        break;
+    case STK500V2_STATE_SIZE_LOW:
+        parser->size |= data;
+        parser->index = 0u;
+        parser->state = (parser->size > 0u && parser->size <= STK500V2_BODY_MAX) ? STK500V2_STATE_TOKEN
+                                                                                 : STK500V2_STATE_START;
+        break;
+    case STK500V2_STATE_TOKEN:
+        parser->state = (data == STK500V2_TOKEN) ? STK500V2_STATE_BODY : STK500V2_STATE_START;
+        break;
+    case STK500V2_STATE_BODY:
+        body[parser->index++] = data;
+        if (parser->index >= parser->size) {
+            parser->state = STK500V2_STATE_CHECKSUM;
+        }
+        break;
+    default:
+        // All bytes including the checksum xor to zero.
+        parser->state = STK500V2_STATE_START;
+        return (parser->checksum == 0u) ? STK500V2_MESSAGE : STK500V2_CHECKSUM_ERROR;
+    }
+    return STK500V2_RECEIVING;
+}
+
+/// Build the header of the answer to the last message.
+///
+/// @param parser The parser, holds the sequence number of the message.
+/// @param size The size of the answer body.
+/// @param header The header, @ref STK500V2_HEADER_SIZE bytes.
+static inline void stk500v2_answer_header(const stk500v2_parser_t* parser, uint16_t size, uint8_t* header) {
+    header[0] = STK500V2_MESSAGE_START;
+    header[1] = parser->sequence;
+    header[2] = (uint8_t)(size >> 8u);
+    header[3] = (uint8_t)size;
+    header[4] = STK500V2_TOKEN;
+}
+
+/// Continue the checksum over a block.
+///
+/// @param checksum The checksum so far, 0 to start.
+/// @param data The block.
+/// @param length The size of the block.
+/// @return The checksum.
+static inline uint8_t stk500v2_checksum(uint8_t checksum, const uint8_t* data, uint16_t length) {
+    while (length-- > 0u) {
+        checksum ^= *data++;
+    }
+    return checksum;
+}
+
+/// Get a 16 bit parameter.
+///
+/// @param session The session.
+/// @param low The parameter holding the low byte, the high byte follows.
+/// @return The value.
+static inline uint16_t stk500v2_get_parameter16(const stk500v2_session_t* session, uint8_t low) {
+    return ((uint16_t)session->parameters[low + 1u - STK500V2_PARAM_FIRST] << 8u) |
+           session->parameters[low - STK500V2_PARAM_FIRST];
+}
+
+/// Set a 16 bit parameter.
+///
+/// @param session The session.
+/// @param low The parameter holding the low byte, the high byte follows.
+/// @param value The value.
+static inline void stk500v2_set_parameter16(stk500v2_session_t* session, uint8_t low, uint16_t value) {
+    session->parameters[low - STK500V2_PARAM_FIRST] = (uint8_t)value;
+    session->parameters[low + 1u - STK500V2_PARAM_FIRST] = (uint8_t)(value >> 8u);
+}
+
+/// Check if a block only holds 0xFF.
+///
+/// @param data The block.
+/// @param length The size of the block.
+/// @return True if blank.
+static inline bool stk500v2_blank(const uint8_t* data, uint16_t length) {
+    while (length-- > 0u) {
+        if (*data++ != 0xFFu) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Send a 4 byte ISP instruction.
+///
+/// @param command The instruction.
+/// @param index The byte of the answer to return, 0..3.
+/// @return The byte shifted out by the target during that byte.
+static inline uint8_t stk500v2_isp_instruction(const uint8_t* command, uint8_t index) {
+    uint8_t result = 0u;
+    for (uint8_t byte = 0u; byte < 4u; byte++) {
+        uint8_t data = stk500v2_isp_transfer(command[byte]);
+        if (byte == index) {
+            result = data;
+        }
+    }
+    return result;
+}
+
+/// Wait for the end of a write as selected by the mode byte of the program commands.
+///
+/// @param polling Bit 0: timed delay, bit 1: value polling, bit 2: RDY/BSY polling.
+/// @param delay The delay in ms.
+/// @param flash_page True after a flash page write.
+/// @return False on timeout.
+static inline bool stk500v2_write_wait(uint8_t polling, uint8_t delay, bool flash_page) {
+    // Value polling is replaced by RDY/BSY polling, which all ISP capable AVRs support.
+    if (polling & 0x06u) {
+        return stk500v2_isp_wait_ready(flash_page);
+    }
+    stk500v2_delay_ms(delay);
+    return true;
+}
+
+/// Program flash or eeprom: `NumBytes(2) Mode Delay cmd1 cmd2 cmd3 poll1 poll2 Data...`.
+///
+/// @param session The session, the address is incremented.
+/// @param body The message, replaced by the answer.
+/// @param size The size of the message.
+/// @param flash True: flash (word address, low/high byte), false: eeprom (byte address).
+/// @return The size of the answer.
+static inline uint16_t stk500v2_program(stk500v2_session_t* session, uint8_t* body, uint16_t size, bool flash) {
+    uint16_t length = ((uint16_t)body[1] << 8u) | body[2];
+    uint8_t mode = body[3];
+    uint8_t polling = (mode & STK500V2_MODE_PAGE) ? (uint8_t)(mode >> 4u) : (uint8_t)(mode >> 1u);
+    uint16_t page = (uint16_t)session->address;
+    bool ready = true;
+
+    if (size < 10u || length > (size - 10u)) {
+        body[1] = STK500V2_STATUS_CMD_FAILED;
+        return 2u;
+    }
+
+    // Writing 0xFF doesn't change the flash, a blank page is neither loaded nor written.
+    if (flash && (mode & (STK500V2_MODE_PAGE | STK500V2_MODE_WRITE_PAGE)) == (STK500V2_MODE_PAGE | STK500V2_MODE_WRITE_PAGE) &&
+        stk500v2_blank(&body[10], length)) {
+        session->address += length / 2u;
+        stk500v2_set_parameter16(session, STK500V2_PARAM_BLANK_PAGES_LOW,
+                                 stk500v2_get_parameter16(session, STK500V2_PARAM_BLANK_PAGES_LOW) + 1u);
+        body[1] = STK500V2_STATUS_CMD_OK;
+        return 2u;
+    }
+
+    for (uint16_t index = 0u; index < length && ready; index++) {
+        uint16_t address = (uint16_t)session->address;
+        uint8_t command[4] = {body[5], (uint8_t)(address >> 8u), (uint8_t)address, body[10u + index]};
+
+        // The high byte of a flash word is loaded with bit 3 of the command set.
+        if (flash && (index & 1u)) {
+            command[0] |= 0x08u;
+        }
+        stk500v2_isp_instruction(command, 3u);
+        if (!(mode & STK500V2_MODE_PAGE)) {
+            ready = stk500v2_write_wait(polling, body[4], false);
+        }
+        if (!flash || (index & 1u)) {
+            session->address++;
+        }
+    }
+
+    if (ready && (mode & (STK500V2_MODE_PAGE | STK500V2_MODE_WRITE_PAGE)) == (STK500V2_MODE_PAGE | STK500V2_MODE_WRITE_PAGE)) {
+        uint8_t command[4] = {body[6], (uint8_t)(page >> 8u), (uint8_t)page, 0x00u};
+        stk500v2_isp_instruction(command, 3u);
+        ready = stk500v2_write_wait(polling, body[4], flash);
+    }
+
+    body[1] = ready ? STK500V2_STATUS_CMD_OK : STK500V2_STATUS_RDY_BSY_TOUT;
+    return 2u;
+}
+
+/// Read flash or eeprom: `NumBytes(2) cmd1`, answered with `Status Data... Status`.
+///
+/// @param session The session, the address is incremented.
+/// @param body The message, replaced by the answer.
+/// @param flash True: flash (word address, low/high byte), false: eeprom (byte address).
+/// @return The size of the answer.
+static inline uint16_t stk500v2_read(stk500v2_session_t* session, uint8_t* body, bool flash) {
+    uint16_t length = ((uint16_t)body[1] << 8u) | body[2];
+    uint8_t read_command = body[3];
+
+    if (length > (STK500V2_BODY_MAX - 3u)) {
+        body[1] = STK500V2_STATUS_CMD_FAILED;
+        return 2u;
+    }
+
+    for (uint16_t index = 0u; index < length; index++) {
+        uint16_t address = (uint16_t)session->address;
+        uint8_t command[4] = {read_command, (uint8_t)(address >> 8u), (uint8_t)address, 0x00u};
+
+        if (flash && (index & 1u)) {
+            command[0] |= 0x08u;
+        }
+        body[2u + index] = stk500v2_isp_instruction(command, 3u);
+        if (!flash || (index & 1u)) {
+            session->address++;
+        }
+    }
+
+    body[1] = STK500V2_STATUS_CMD_OK;
+    body[2u + length] = STK500V2_STATUS_CMD_OK;
+    return length + 3u;
+}
+
+/// Send up to 255 bytes and return some of the bytes shifted out: `NumTx NumRx RxStartAddr TxData...`.
+///
+/// @param body The message, replaced by the answer.
+/// @param size The size of the message.
+/// @return The size of the answer.
+static inline uint16_t stk500v2_spi_multi(uint8_t* body, uint16_t size) {
+    uint8_t transmit = body[1];
+    uint8_t receive = body[2];
+    uint8_t start = body[3];
+    uint8_t received = 0u;
+
+    if (size < 4u || transmit > (size - 4u) || receive > (STK500V2_BODY_MAX - 3u)) {
+        body[1] = STK500V2_STATUS_CMD_FAILED;
+        return 2u;
+    }
+
+    // The answer overwrites the message behind the byte being sent, zeros are sent after the data.
+    for (uint16_t index = 0u; index < transmit || received < receive; index++) {
+        uint8_t data = stk500v2_isp_transfer((index < transmit) ? body[4u + index] : 0x00u);
+        if (index >= start && received < receive) {
+            body[2u + received++] = data;
+        }
+    }
+
+    body[1] = STK500V2_STATUS_CMD_OK;
+    body[2u + receive] = STK500V2_STATUS_CMD_OK;
+    return receive + 3u;
+}
+
+/// Execute a message and replace it by the answer.
+///
+/// @param session The session.
+/// @param body The message, replaced by the answer. @ref STK500V2_BODY_MAX bytes.
+/// @param size The size of the message.
+/// @return The size of the answer.
+static inline uint16_t stk500v2_command(stk500v2_session_t* session, uint8_t* body, uint16_t size) {
+    // Parameters outside of 0x80..0x9F wrap around, none of them is used.
+    uint8_t* parameter = &session->parameters[(uint8_t)(body[1] - STK500V2_PARAM_FIRST) % STK500V2_PARAM_COUNT];
+
+    switch (body[0]) {
+    case STK500V2_CMD_SIGN_ON: {
+        const char* name = "STK500_2";
+        body[1] = STK500V2_STATUS_CMD_OK;
+        body[2] = 8u;
+        for (uint8_t index = 0u; index < 8u; index++) {
+            body[3u + index] = (uint8_t)name[index];
+        }
+        return 11u;
+    }
+    case STK500V2_CMD_SET_PARAMETER:
+        *parameter = body[2];
+        body[1] = STK500V2_STATUS_CMD_OK;
+        return 2u;
+    case STK500V2_CMD_GET_PARAMETER:
+        body[2] = *parameter;
+        body[1] = STK500V2_STATUS_CMD_OK;
+        return 3u;
+    case STK500V2_CMD_LOAD_ADDRESS:
+        // Bit 31 requests the extended address byte of devices > 128kB, not supported.
+        session->address = (((uint32_t)body[1] << 24u) | ((uint32_t)body[2] << 16u) | ((uint32_t)body[3] << 8u) | body[4]) &
+                           0x7FFFFFFFlu;
+        body[1] = STK500V2_STATUS_CMD_OK;
+        return 2u;
+    case STK500V2_CMD_ENTER_PROGMODE_ISP:
+        // The clock and the sync are handled by the includer, the timing parameters are not needed.
+        stk500v2_set_parameter16(session, STK500V2_PARAM_BLANK_PAGES_LOW, 0u);
+        body[1] = stk500v2_isp_enter(session) ? STK500V2_STATUS_CMD_OK : STK500V2_STATUS_CMD_FAILED;
+        return 2u;
+    case STK500V2_CMD_LEAVE_PROGMODE_ISP:
+        stk500v2_isp_leave();
+        body[1] = STK500V2_STATUS_CMD_OK;
+        return 2u;
+    case STK500V2_CMD_CHIP_ERASE_ISP:
+        // eraseDelay pollMethod cmd1..cmd4
+        stk500v2_isp_instruction(&body[3], 3u);
+        body[1] = stk500v2_write_wait((body[2] == 1u) ? 0x04u : 0x01u, body[1], false) ? STK500V2_STATUS_CMD_OK
+                                                                                      : STK500V2_STATUS_RDY_BSY_TOUT;
+        return 2u;
+    case STK500V2_CMD_PROGRAM_FLASH_ISP:
+    case STK500V2_CMD_PROGRAM_EEPROM_ISP:
+        return stk500v2_program(session, body, size, body[0] == STK500V2_CMD_PROGRAM_FLASH_ISP);
+    case STK500V2_CMD_READ_FLASH_ISP:
+    case STK500V2_CMD_READ_EEPROM_ISP:
+        return stk500v2_read(session, body, body[0] == STK500V2_CMD_READ_FLASH_ISP);
+    case STK500V2_CMD_PROGRAM_FUSE_ISP:
+    case STK500V2_CMD_PROGRAM_LOCK_ISP:
+        // cmd1..cmd4, the target is busy for t_WD_FUSE afterwards
+        stk500v2_isp_instruction(&body[1], 3u);
+        body[1] = stk500v2_isp_wait_ready(false) ? STK500V2_STATUS_CMD_OK : STK500V2_STATUS_RDY_BSY_TOUT;
+        body[2] = STK500V2_STATUS_CMD_OK;
+        return 3u;
+    case STK500V2_CMD_READ_FUSE_ISP:
+    case STK500V2_CMD_READ_LOCK_ISP:
+    case STK500V2_CMD_READ_SIGNATURE_ISP:
+    case STK500V2_CMD_READ_OSCCAL_ISP:
+        // RetAddr cmd1..cmd4, RetAddr counts from 1
+        body[2] = stk500v2_isp_instruction(&body[2], (uint8_t)(body[1] - 1u));
+        body[1] = STK500V2_STATUS_CMD_OK;
+        body[3] = STK500V2_STATUS_CMD_OK;
+        return 4u;
+    case STK500V2_CMD_SPI_MULTI:
+        return stk500v2_spi_multi(body, size);
+    default:
+        body[1] = STK500V2_STATUS_CMD_UNKNOWN;
+        return 2u;
+    }
+}
+
+/// Build the answer to a message with a wrong checksum.
+///
+/// @param body The message buffer, replaced by the answer.
+/// @return The size of the answer.
+static inline uint16_t stk500v2_checksum_error(uint8_t* body) {
+    body[0] = STK500V2_ANSWER_CKSUM_ERROR;
+    body[1] = STK500V2_STATUS_CKSUM_ERROR;
+    return 2u;
+}
+
+#endif // STK500V2_H
@@ -36,28 +36,31 @@
 // 7: Programming - In communication with the target
 //
 #include <Arduino.h>
-
-#define SLOW_PROGRAMMING 0
+#include "crc32.h"
 
 #undef SERIAL
 
-// Configure SPI clock (in Hz).
+// Configure the SPI clocks (in Hz), fastest first.
 // E.g. for an ATtiny @ 128 kHz: the datasheet states that both the high and low
 // SPI clock pulse must be > 2 CPU cycles, so take 3 cycles i.e. divide target
 // f_cpu by 6:
-//     #define SPI_CLOCK            (128000/6)
+//     (128000/6)
 //
-// A clock slow enough for an ATtiny85 @ 1 MHz, is a reasonable default:
-
-#if SLOW_PROGRAMMING == 1
-
-// For normal clock.
-#define SPI_CLOCK (1000000 / 6)
-#else
-
-// For slow clock (128kHz).
-#define SPI_CLOCK (25000 / 6)
-#endif
+// start_pmode() tries the clocks in this order and programs with the first one
+// the target answers to, so the same programmer handles an ATtiny85 @ 1 MHz
+// (production fuses) and @ 128 kHz (calibration fuses).
+//
+// The target allows up to 2 of its CPU cycles per pulse, i.e. f_cpu / 4. The
+// clocks below use the lower end of the RC oscillator tolerance (8 MHz, 1 MHz:
+// -10%, 128 kHz: down to 98 kHz, see SLEEP_CLOCK_DEVIATION_MAX_HZ of the time
+// switch). The timed bit-banged SPI rounds them down to whole timer ticks, on a
+// 16 MHz Uno (0.5 usec ticks) that gives 200 kHz, 23.8 kHz and 3.9 kHz, the
+// edges come a few CPU cycles later than the timer. The first clock is limited
+// by the transfer loop instead, a few 100 kHz (one tick per pulse at most 1 MHz).
+
+// For slow clock (128kHz), the last resort.
+#define SPI_CLOCK_MIN (25000 / 6)
+#define SPI_CLOCKS {7200000 / 4, 900000 / 4, 96000 / 4, SPI_CLOCK_MIN}
 
 #define PROG_FLICKER true
 
@@ -67,7 +70,7 @@
 
 #if defined(ARDUINO_ARCH_AVR)
 
-#if SPI_CLOCK > (F_CPU / 128)
+#if SPI_CLOCK_MIN > (F_CPU / 128)
 #define USE_HARDWARE_SPI
 #endif
 
@@ -82,6 +85,7 @@
 #define LED_HB 9
 #define LED_ERR 8
 #define LED_PMODE 7
+#define BUTTON 6 // standalone programming, to GND
 
 // Uncomment following line to use the old Uno style wiring
 // (using pin 11, 12 and 13 instead of the SPI header) on Leonardo, Due...
@@ -104,6 +108,7 @@
 #define LED_HB 7
 #define LED_ERR 6
 #define LED_PMODE 5
+#define BUTTON 3
 
 #endif
 
@@ -125,6 +130,14 @@
 #undef USE_HARDWARE_SPI
 #endif
 
+// The bitbanged SPI uses direct port access and paces the edges with the free
+// running timer 2 where there is one (not on the Leonardo, Due, Zero...).
+// Timer 2 is taken from PWM/tone() on its pins, the sketch doesn't use them
+// (except on the Mega, where the heartbeat LED on pin 9 stops fading).
+#if defined(ARDUINO_ARCH_AVR) && defined(TCNT2)
+#define USE_TIMED_BITBANG
+#endif
+
 // Configure the serial port to use.
 //
 // Prefer the USB virtual serial port (aka. native USB port), if the Arduino has one:
@@ -145,14 +158,44 @@
 
 // Configure the baud rate:
 
-#define BAUDRATE 19200
-// #define BAUDRATE	115200
+// #define BAUDRATE	19200
+#define BAUDRATE 115200
 // #define BAUDRATE	1000000
 
+// Select the protocol:
+// 1: STK500v1 (avrdude -c stk500v1)
+// 2: STK500v2 (avrdude -c stk500v2), larger messages with checksum, see stk500v2.h
+#ifndef STK500_VERSION
+#define STK500_VERSION 1
+#endif
+
+// Standalone production programming (pio run -e uno_standalone): the firmware,
+// eeprom and fuses written by tools/standalone_image.cpp are kept in the flash of
+// the programmer. A press on BUTTON or the vendor command 'X' programs a board
+// without a PC: erase, flash, verify, eeprom, fuses, at the fastest SPI clock the
+// target answers to. Afterwards LED_PMODE is on if the board passed, LED_ERR if
+// it failed (after blinking the number of the failed step, see standalone()).
+#ifdef STANDALONE
+#include "standalone_image.h"
+#endif
+
 #define HWVER 2
 #define SWMAJ 1
 #define SWMIN 18
 
+// Vendor parameters (unused by STK500v1 and STK500v2): blank flash pages
+// skipped since entering programming mode and the estimated time saved in ms
+#define PARAM_BLANK_PAGES_LOW 0x8A
+#define PARAM_BLANK_PAGES_HIGH 0x8B
+#define PARAM_SAVED_MS_LOW 0x8C
+#define PARAM_SAVED_MS_HIGH 0x8D
+
+// Vendor command (unused by STK500v1): CRC32 of a memory range, read by the
+// programmer, see crc_page()
+#define STK_CRC_PAGE 0x43
+// Vendor command (unused by STK500v1): program the standalone image, see standalone()
+#define STK_STANDALONE 0x58
+
 // STK Definitions
 #define STK_OK 0x10
 #define STK_FAILED 0x11
@@ -165,7 +208,14 @@ int ISPError = 0;
 int pmode = 0;
 // address for reading and writing, set by 'U' command
 unsigned int here;
+#if STK500_VERSION == 2
+#include "stk500v2.h"
+uint8_t buff[STK500V2_BODY_MAX]; // global block storage, also the STK500v2 message buffer
+stk500v2_parser_t v2_parser;
+stk500v2_session_t v2_session;
+#else
 uint8_t buff[256]; // global block storage
+#endif
 
 #define beget16(addr) (*addr * 256 + *(addr + 1))
 typedef struct param {
@@ -182,10 +232,22 @@ typedef struct param {
     uint16_t pagesize;
     uint16_t eepromsize;
     uint32_t flashsize;
+    uint8_t eeprompagesize; // from the extended parameters, 0 if unknown
 } parameter;
 
 parameter param;
 static bool rst_active_high;
+// when the programming lamp was switched off for the last page write
+static unsigned long prog_lamp_time;
+static const uint32_t spi_clocks[] = SPI_CLOCKS;
+// blank flash pages skipped, see write_flash()
+static unsigned int blank_pages;
+// duration of the last flash page write of the target, see wait_page_written()
+static unsigned long write_cycle_micros;
+#ifdef STANDALONE
+// the last standalone programming passed, LED_PMODE stays on
+static bool standalone_passed;
+#endif
 
 void pulse(int pin, int times);
 uint8_t getch();
@@ -194,24 +256,33 @@ uint8_t spi_transaction(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
 void empty_reply();
 void breply(uint8_t b);
 void get_version(uint8_t c);
+uint8_t blank_page_parameter(uint8_t c);
 void set_parameters();
-void start_pmode();
+void set_extended_parameters();
+bool start_pmode();
+bool program_enable();
 void end_pmode();
 void universal();
 void flash(uint8_t hilo, unsigned int addr, uint8_t data);
-void commit(unsigned int addr);
+uint8_t commit(unsigned int addr);
 unsigned int current_page();
 void write_flash(int length);
-uint8_t write_flash_pages(int length);
 uint8_t write_eeprom(unsigned int length);
 uint8_t write_eeprom_chunk(unsigned int start, unsigned int length);
+bool wait_ready();
+bool wait_page_written();
 void program_page();
 uint8_t flash_read(uint8_t hilo, unsigned int addr);
 char flash_read_page(int length);
 char eeprom_read_page(int length);
 void read_page();
+void crc_page();
 void read_signature();
 void avrisp();
+void stk500v2();
+uint8_t standalone();
+uint8_t standalone_program();
+bool standalone_button();
 void heartbeat();
 void reset_target(bool reset);
 
@@ -240,6 +311,89 @@ private:
 };
 #endif                           // !defined(ARDUINO_API_VERSION)
 
+#ifdef USE_TIMED_BITBANG
+
+// timer 2 ticks at F_CPU / 8 (0.5 usec on 16 MHz), slower clocks than that
+// range covers use F_CPU / 64 (4 usec on 16 MHz)
+#define BITBANG_TIMER_PRESCALER 8
+#define BITBANG_TIMER_PRESCALER_SLOW 64
+// a half period of at most 128 ticks can't be missed by polling the 8 bit timer
+// late (64 usec at F_CPU / 8 on 16 MHz, SPI clocks >= 7.8 kHz)
+#define BITBANG_TICKS_MAX 128
+
+class BitBangedSPI {
+public:
+    void begin() {
+        digitalWrite(PIN_SCK, LOW);
+        digitalWrite(PIN_MOSI, LOW);
+        pinMode(PIN_SCK, OUTPUT);
+        pinMode(PIN_MOSI, OUTPUT);
+        pinMode(PIN_MISO, INPUT);
+
+        sckPort = portOutputRegister(digitalPinToPort(PIN_SCK));
+        sckMask = digitalPinToBitMask(PIN_SCK);
+        mosiPort = portOutputRegister(digitalPinToPort(PIN_MOSI));
+        mosiMask = digitalPinToBitMask(PIN_MOSI);
+        misoPin = portInputRegister(digitalPinToPort(PIN_MISO));
+        misoMask = digitalPinToBitMask(PIN_MISO);
+
+        // normal mode, free running
+        TCCR2A = 0;
+        TCCR2B = _BV(CS21);
+    }
+
+    void beginTransaction(SPISettings settings) {
+        // Round up, the pulses must not get shorter than requested. The edge is
+        // read up to a tick late, but a tick of F_CPU / 8 is 8 CPU cycles and the
+        // loop spends more than that between seeing the timer and the next edge.
+        uint32_t ticks = (F_CPU / BITBANG_TIMER_PRESCALER / 2 + settings.getClockFreq() - 1) / settings.getClockFreq();
+        uint8_t prescaler = _BV(CS21);
+        if (ticks > BITBANG_TICKS_MAX) {
+            // 64 CPU cycles per tick, here the late edge read needs its own tick
+            ticks = (F_CPU / BITBANG_TIMER_PRESCALER_SLOW / 2 + settings.getClockFreq() - 1) / settings.getClockFreq() + 1;
+            prescaler = _BV(CS22);
+        }
+        TCCR2B = prescaler;
+        halfPeriod = (ticks > BITBANG_TICKS_MAX) ? BITBANG_TICKS_MAX : ticks;
+    }
+
+    void end() {
+    }
+
+    uint8_t transfer(uint8_t b) {
+        // each pulse is timed from its own edge, a delay by an interrupt only makes it longer
+        for (uint8_t i = 0; i < 8; ++i) {
+            if (b & 0x80) {
+                *mosiPort |= mosiMask;
+            } else {
+                *mosiPort &= ~mosiMask;
+            }
+            *sckPort |= sckMask;
+            waitHalfPeriod(TCNT2);
+            b = (b << 1) | ((*misoPin & misoMask) ? 1 : 0);
+            *sckPort &= ~sckMask; // slow pulse
+            waitHalfPeriod(TCNT2);
+        }
+        return b;
+    }
+
+private:
+    void waitHalfPeriod(uint8_t edge) {
+        while ((uint8_t)(TCNT2 - edge) < halfPeriod)
+            ;
+    }
+
+    volatile uint8_t* sckPort;
+    volatile uint8_t* mosiPort;
+    volatile uint8_t* misoPin;
+    uint8_t sckMask;
+    uint8_t mosiMask;
+    uint8_t misoMask;
+    uint8_t halfPeriod; // in timer ticks
+};
+
+#else
+
 class BitBangedSPI {
 public:
     void begin() {
@@ -276,6 +430,8 @@ private:
     unsigned long pulseWidth; // in microseconds
 };
 
+#endif
+
 static BitBangedSPI SPI;
 
 #endif
@@ -349,11 +505,35 @@ void get_version(uint8_t c) {
     case 0x93:
         breply('S'); // serial programmer
         break;
+    case PARAM_BLANK_PAGES_LOW:
+    case PARAM_BLANK_PAGES_HIGH:
+    case PARAM_SAVED_MS_LOW:
+    case PARAM_SAVED_MS_HIGH:
+        breply(blank_page_parameter(c));
+        break;
     default:
         breply(0);
     }
 }
 
+// the saved time is estimated with the last flash page write, the skipped page loads come on top
+uint8_t blank_page_parameter(uint8_t c) {
+    unsigned long saved_ms = ((unsigned long)blank_pages * write_cycle_micros) / 1000;
+    if (saved_ms > 0xFFFF) {
+        saved_ms = 0xFFFF;
+    }
+    switch (c) {
+    case PARAM_BLANK_PAGES_LOW:
+        return blank_pages & 0xFF;
+    case PARAM_BLANK_PAGES_HIGH:
+        return (blank_pages >> 8) & 0xFF;
+    case PARAM_SAVED_MS_LOW:
+        return saved_ms & 0xFF;
+    default:
+        return (saved_ms >> 8) & 0xFF;
+    }
+}
+
 void set_parameters() {
     // call this after reading parameter packet into buff[]
     param.devicecode = buff[0];
@@ -378,7 +558,14 @@ void set_parameters() {
     rst_active_high = (param.devicecode >= 0xe0);
 }
 
-void start_pmode() {
+void set_extended_parameters() {
+    // call this after reading the extended parameter packet into buff[]
+    // buff[0] is the command size, buff[1] the eeprom page size
+    param.eeprompagesize = buff[1];
+}
+
+bool start_pmode() {
+    bool sync = false;
 
     // Reset target before driving PIN_SCK or PIN_MOSI
 
@@ -389,23 +576,47 @@ void start_pmode() {
     reset_target(true);
     pinMode(RESET, OUTPUT);
     SPI.begin();
-    SPI.beginTransaction(SPISettings(SPI_CLOCK, MSBFIRST, SPI_MODE0));
 
-    // See AVR datasheets, chapter "SERIAL_PRG Programming Algorithm":
+    for (uint8_t i = 0; i < sizeof(spi_clocks) / sizeof(spi_clocks[0]); i++) {
+        SPI.beginTransaction(SPISettings(spi_clocks[i], MSBFIRST, SPI_MODE0));
 
-    // Pulse RESET after PIN_SCK is low:
-    digitalWrite(PIN_SCK, LOW);
-    delay(20); // discharge PIN_SCK, value arbitrarily chosen
-    reset_target(false);
-    // Pulse must be minimum 2 target CPU clock cycles so 100 usec is ok for CPU
-    // speeds above 20 KHz
-    delayMicroseconds(100);
-    reset_target(true);
+        // See AVR datasheets, chapter "SERIAL_PRG Programming Algorithm":
 
-    // Send the enable programming command:
-    delay(50); // datasheet: must be > 20 msec
-    spi_transaction(0xAC, 0x53, 0x00, 0x00);
+        // Pulse RESET after PIN_SCK is low:
+        digitalWrite(PIN_SCK, LOW);
+        delay(20); // discharge PIN_SCK, value arbitrarily chosen
+        reset_target(false);
+        // Pulse must be minimum 2 target CPU clock cycles so 100 usec is ok for CPU
+        // speeds above 20 KHz
+        delayMicroseconds(100);
+        reset_target(true);
+
+        // Send the enable programming command:
+        delay(50); // datasheet: must be > 20 msec
+        if (program_enable()) {
+            sync = true;
+            break;
+        }
+    }
+    // AT89Sx don't echo, they are programmed with the slowest clock
+    if (!sync && !rst_active_high) {
+        ISPError++;
+    }
     pmode = 1;
+    blank_pages = 0;
+#ifdef STANDALONE
+    standalone_passed = false;
+#endif
+    return sync || rst_active_high;
+}
+
+// an AVR in sync echoes the second byte of the enable programming command
+bool program_enable() {
+    SPI.transfer(0xAC);
+    SPI.transfer(0x53);
+    uint8_t echo = SPI.transfer(0x00);
+    SPI.transfer(0x00);
+    return echo == 0x53;
 }
 
 void end_pmode() {
@@ -430,15 +641,18 @@ void flash(uint8_t hilo, unsigned int addr, uint8_t data) {
     spi_transaction(0x40 + 8 * hilo, addr >> 8 & 0xFF, addr & 0xFF, data);
 }
 
-void commit(unsigned int addr) {
+uint8_t commit(unsigned int addr) {
+    // the lamp flickers without blocking, loop() switches it on again after PTIME
     if (PROG_FLICKER) {
         prog_lamp(LOW);
+        prog_lamp_time = millis();
     }
     spi_transaction(0x4C, (addr >> 8) & 0xFF, addr & 0xFF, 0);
-    if (PROG_FLICKER) {
-        delay(PTIME);
-        prog_lamp(HIGH);
+    if (!wait_page_written()) {
+        ISPError++;
+        return STK_FAILED;
     }
+    return STK_OK;
 }
 
 unsigned int current_page() {
@@ -458,32 +672,56 @@ unsigned int current_page() {
 }
 
 void write_flash(int length) {
-    fill(length);
-    if (CRC_EOP == getch()) {
-        SERIAL.print((char)STK_INSYNC);
-        SERIAL.print((char)write_flash_pages(length));
-    } else {
-        ISPError++;
-        SERIAL.print((char)STK_NOSYNC);
-    }
-}
-
-uint8_t write_flash_pages(int length) {
-    int x = 0;
+    // the data is loaded into the target while the rest of it is still arriving,
+    // the last page is only written once the command is complete
+    uint8_t result = STK_OK;
     unsigned int page = current_page();
-    while (x < length) {
+    int page_start = 0;
+    bool blank = true;
+    int received = 0;
+    for (int x = 0; x < length; x += 2) {
+        // take everything that arrived so far, so the serial buffer can't overflow
+        // while the target is slowly clocked
+        while (received < length && (received < x + 2 || SERIAL.available())) {
+            buff[received++] = getch();
+        }
         if (page != current_page()) {
-            commit(page);
+            if (blank) {
+                blank_pages++;
+            } else if (result == STK_OK) {
+                result = commit(page);
+            }
             page = current_page();
+            page_start = x;
+            blank = true;
+        }
+        // writing 0xFF doesn't change the flash, a blank page is neither loaded nor written
+        if (blank && (buff[x] != 0xFF || buff[x + 1] != 0xFF)) {
+            for (int y = page_start; y < x; y += 2) {
+                flash(LOW, here - (x - y) / 2, 0xFF);
+                flash(HIGH, here - (x - y) / 2, 0xFF);
+            }
+            blank = false;
+        }
+        if (!blank) {
+            flash(LOW, here, buff[x]);
+            flash(HIGH, here, buff[x + 1]);
         }
-        flash(LOW, here, buff[x++]);
-        flash(HIGH, here, buff[x++]);
         here++;
     }
 
-    commit(page);
-
-    return STK_OK;
+    if (CRC_EOP == getch()) {
+        SERIAL.print((char)STK_INSYNC);
+        if (blank) {
+            blank_pages++;
+        } else if (result == STK_OK) {
+            result = commit(page);
+        }
+        SERIAL.print((char)result);
+    } else {
+        ISPError++;
+        SERIAL.print((char)STK_NOSYNC);
+    }
 }
 
 #define EECHUNK (32)
@@ -496,26 +734,71 @@ uint8_t write_eeprom(unsigned int length) {
         return STK_FAILED;
     }
     while (remaining > EECHUNK) {
+        fill(EECHUNK);
         write_eeprom_chunk(start, EECHUNK);
         start += EECHUNK;
         remaining -= EECHUNK;
     }
+    fill(remaining);
     write_eeprom_chunk(start, remaining);
     return STK_OK;
 }
 
-// write (length) bytes, (start) is a byte address
+// write (length) bytes of buff[], (start) is a byte address
 uint8_t write_eeprom_chunk(unsigned int start, unsigned int length) {
-    // this writes byte-by-byte, page writing may be faster (4 bytes at a time)
-    fill(length);
+    uint8_t result = STK_OK;
+    unsigned int pagesize = param.eeprompagesize;
+    unsigned int x = 0;
+
+    // page writing needs the page size of the extended parameters, else write byte-by-byte
+    if (pagesize == 0 || (pagesize & (pagesize - 1)) != 0) {
+        pagesize = 1;
+    }
+
     prog_lamp(LOW);
-    for (unsigned int x = 0; x < length; x++) {
-        unsigned int addr = start + x;
-        spi_transaction(0xC0, (addr >> 8) & 0xFF, addr & 0xFF, buff[x]);
-        delay(45);
+    while (x < length && result == STK_OK) {
+        unsigned int page = (start + x) & ~(pagesize - 1);
+        if (pagesize == 1) {
+            spi_transaction(0xC0, (page >> 8) & 0xFF, page & 0xFF, buff[x++]);
+        } else {
+            // load the bytes of this page, then write it at once
+            do {
+                spi_transaction(0xC1, 0x00, (start + x) & (pagesize - 1), buff[x]);
+                x++;
+            } while (x < length && ((start + x) & (pagesize - 1)) != 0);
+            spi_transaction(0xC2, (page >> 8) & 0xFF, page & 0xFF, 0x00);
+        }
+        if (!wait_ready()) {
+            ISPError++;
+            result = STK_FAILED;
+        }
     }
     prog_lamp(HIGH);
-    return STK_OK;
+    return result;
+}
+
+// poll the RDY/BSY flag of the target until the write cycle is done
+// (at the slowest SPI clock one poll takes about 8ms)
+#define READY_TIMEOUT 60
+bool wait_ready() {
+    unsigned long start = millis();
+    while (spi_transaction(0xF0, 0x00, 0x00, 0x00) & 0x01) {
+        if ((millis() - start) > READY_TIMEOUT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// wait for the flash page write just started and keep its duration, eeprom and
+// fuse writes take differently long
+bool wait_page_written() {
+    unsigned long start_micros = micros();
+    if (!wait_ready()) {
+        return false;
+    }
+    write_cycle_micros = micros() - start_micros;
+    return true;
 }
 
 void program_page() {
@@ -547,13 +830,22 @@ uint8_t flash_read(uint8_t hilo, unsigned int addr) {
     return spi_transaction(0x20 + hilo * 8, (addr >> 8) & 0xFF, addr & 0xFF, 0);
 }
 
+// bytes read into buff[] and sent at once, the serial interrupt transmits them
+// while the next ones are read from the target
+#define READ_CHUNK 16
 char flash_read_page(int length) {
+    int n = 0;
     for (int x = 0; x < length; x += 2) {
-        uint8_t low = flash_read(LOW, here);
-        SERIAL.print((char)low);
-        uint8_t high = flash_read(HIGH, here);
-        SERIAL.print((char)high);
+        buff[n++] = flash_read(LOW, here);
+        buff[n++] = flash_read(HIGH, here);
         here++;
+        if (n >= READ_CHUNK) {
+            SERIAL.write(buff, n);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        SERIAL.write(buff, n);
     }
     return STK_OK;
 }
@@ -561,10 +853,17 @@ char flash_read_page(int length) {
 char eeprom_read_page(int length) {
     // here again we have a word address
     int start = here * 2;
+    int n = 0;
     for (int x = 0; x < length; x++) {
         int addr = start + x;
-        uint8_t ee = spi_transaction(0xA0, (addr >> 8) & 0xFF, addr & 0xFF, 0xFF);
-        SERIAL.print((char)ee);
+        buff[n++] = spi_transaction(0xA0, (addr >> 8) & 0xFF, addr & 0xFF, 0xFF);
+        if (n >= READ_CHUNK) {
+            SERIAL.write(buff, n);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        SERIAL.write(buff, n);
     }
     return STK_OK;
 }
@@ -589,6 +888,48 @@ void read_page() {
     SERIAL.print(result);
 }
 
+// Verify without reading back: same arguments as STK_READ_PAGE, the range
+// starts at here, answer STK_INSYNC, the CRC32 (MSB first, see crc32.h), STK_OK.
+// tools/isp_verify.cpp compares it with the CRC32 of the image, so only 4 bytes
+// cross the serial line instead of the whole memory.
+void crc_page() {
+    uint8_t data[2];
+    uint32_t crc = CRC32_INITIAL;
+    unsigned int length = 256 * getch();
+    length += getch();
+    char memtype = getch();
+    if (CRC_EOP != getch()) {
+        ISPError++;
+        SERIAL.print((char)STK_NOSYNC);
+        return;
+    }
+    SERIAL.print((char)STK_INSYNC);
+    if (memtype == 'F') {
+        for (unsigned int x = 0; x < length; x += 2) {
+            data[0] = flash_read(LOW, here);
+            data[1] = flash_read(HIGH, here);
+            here++;
+            crc = crc32_update(crc, data, (length - x >= 2) ? 2 : 1);
+        }
+    } else if (memtype == 'E') {
+        // here again we have a word address
+        unsigned int start = here * 2;
+        for (unsigned int x = 0; x < length; x++) {
+            unsigned int addr = start + x;
+            data[0] = spi_transaction(0xA0, (addr >> 8) & 0xFF, addr & 0xFF, 0xFF);
+            crc = crc32_update(crc, data, 1);
+        }
+    } else {
+        SERIAL.print((char)STK_FAILED);
+        return;
+    }
+    crc = ~crc;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        SERIAL.print((char)(crc >> shift));
+    }
+    SERIAL.print((char)STK_OK);
+}
+
 void read_signature() {
     if (CRC_EOP != getch()) {
         ISPError++;
@@ -634,8 +975,9 @@ void avrisp() {
         set_parameters();
         empty_reply();
         break;
-    case 'E': // extended parameters - ignore for now
+    case 'E': // extended parameters
         fill(5);
+        set_extended_parameters();
         empty_reply();
         break;
     case 'P':
@@ -668,6 +1010,27 @@ void avrisp() {
         read_page();
         break;
 
+    case STK_CRC_PAGE: // vendor 'C'
+        crc_page();
+        break;
+
+#ifdef STANDALONE
+    case STK_STANDALONE: // vendor 'X', answers the step that failed (0: passed)
+        if (CRC_EOP != getch()) {
+            ISPError++;
+            SERIAL.print((char)STK_NOSYNC);
+            break;
+        }
+        SERIAL.print((char)STK_INSYNC);
+        if (pmode) {
+            SERIAL.print((char)STK_FAILED);
+            break;
+        }
+        SERIAL.print((char)standalone());
+        SERIAL.print((char)STK_OK);
+        break;
+#endif
+
     case 'V': //0x56
         universal();
         break;
@@ -699,6 +1062,213 @@ void avrisp() {
     }
 }
 
+#if STK500_VERSION == 2
+
+// STK500v2: the protocol engine is in stk500v2.h, these functions give it access to the target
+uint8_t stk500v2_isp_transfer(uint8_t data) {
+    return SPI.transfer(data);
+}
+
+bool stk500v2_isp_enter(const stk500v2_session_t* session) {
+    if (pmode) {
+        return true;
+    }
+    rst_active_high = (session->parameters[STK500V2_PARAM_RESET_POLARITY - STK500V2_PARAM_FIRST] == 0);
+    return start_pmode();
+}
+
+void stk500v2_isp_leave(void) {
+    ISPError = 0;
+    end_pmode();
+}
+
+bool stk500v2_isp_wait_ready(bool flash_page) {
+    if (!(flash_page ? wait_page_written() : wait_ready())) {
+        ISPError++;
+        return false;
+    }
+    return true;
+}
+
+void stk500v2_delay_ms(uint8_t ms) {
+    delay(ms);
+}
+
+// a message is dropped if the host pauses within it (ms)
+#define STK500V2_TIMEOUT 200
+void stk500v2() {
+    static unsigned long last_time = 0;
+    unsigned long now = millis();
+    uint8_t header[STK500V2_HEADER_SIZE];
+    uint16_t size;
+
+    if ((now - last_time) > STK500V2_TIMEOUT) {
+        stk500v2_reset(&v2_parser);
+    }
+    last_time = now;
+
+    uint8_t result = stk500v2_receive(&v2_parser, buff, getch());
+    if (result == STK500V2_RECEIVING) {
+        return;
+    }
+    if (result == STK500V2_MESSAGE) {
+        blank_pages = stk500v2_get_parameter16(&v2_session, STK500V2_PARAM_BLANK_PAGES_LOW);
+        stk500v2_set_parameter16(&v2_session, STK500V2_PARAM_SAVED_MS_LOW,
+                                 blank_page_parameter(PARAM_SAVED_MS_LOW) | (blank_page_parameter(PARAM_SAVED_MS_HIGH) << 8));
+        size = stk500v2_command(&v2_session, buff, v2_parser.size);
+    } else {
+        ISPError++;
+        size = stk500v2_checksum_error(buff);
+    }
+
+    // the answer is built in place of the message
+    stk500v2_answer_header(&v2_parser, size, header);
+    SERIAL.write(header, sizeof(header));
+    SERIAL.write(buff, size);
+    SERIAL.write(stk500v2_checksum(stk500v2_checksum(0, header, sizeof(header)), buff, size));
+}
+
+#endif
+
+#ifdef STANDALONE
+
+// the steps of standalone(), LED_ERR blinks the number of the failed one
+#define STANDALONE_PASSED 0
+#define STANDALONE_FAILED_TARGET 1
+#define STANDALONE_FAILED_SIGNATURE 2
+#define STANDALONE_FAILED_ERASE 3
+#define STANDALONE_FAILED_FLASH 4
+#define STANDALONE_FAILED_VERIFY 5
+#define STANDALONE_FAILED_EEPROM 6
+#define STANDALONE_FAILED_FUSES 7
+
+// datasheet tWD_ERASE 4.5ms, then the RDY/BSY flag is polled
+#define STANDALONE_ERASE_DELAY 10
+// the button has to be stable for this long (ms)
+#define BUTTON_DEBOUNCE 30
+
+uint8_t standalone() {
+    // no host sends the device parameters, they come with the image
+    param.pagesize = STANDALONE_FLASH_PAGE_SIZE;
+    param.eepromsize = STANDALONE_EEPROM_SIZE;
+    param.eeprompagesize = STANDALONE_EEPROM_PAGE_SIZE;
+    rst_active_high = false;
+
+    digitalWrite(LED_ERR, LOW);
+    digitalWrite(LED_PMODE, HIGH);
+    uint8_t result = standalone_program();
+    end_pmode();
+
+    standalone_passed = (result == STANDALONE_PASSED);
+    if (standalone_passed) {
+        ISPError = 0;
+    } else {
+        ISPError++;
+        pulse(LED_ERR, result - 1);
+    }
+    return result;
+}
+
+uint8_t standalone_program() {
+    static const uint8_t signature[] = STANDALONE_SIGNATURE;
+    static const uint8_t fuses[] = STANDALONE_FUSES;
+    // low, high, extended fuse
+    static const uint8_t fuse_write[] = {0xA0, 0xA8, 0xA4};
+    static const uint8_t fuse_read[][2] = {{0x50, 0x00}, {0x58, 0x08}, {0x50, 0x08}};
+
+    // start_pmode() takes the fastest SPI clock the target answers to
+    if (!start_pmode()) {
+        return STANDALONE_FAILED_TARGET;
+    }
+    for (uint8_t i = 0; i < sizeof(signature); i++) {
+        if (spi_transaction(0x30, 0x00, i, 0x00) != signature[i]) {
+            return STANDALONE_FAILED_SIGNATURE;
+        }
+    }
+
+    spi_transaction(0xAC, 0x80, 0x00, 0x00);
+    delay(STANDALONE_ERASE_DELAY);
+    if (!wait_ready()) {
+        return STANDALONE_FAILED_ERASE;
+    }
+
+    // the erased flash already holds the blank words, only the others are loaded
+    for (unsigned int page = 0; page < sizeof(standalone_flash); page += STANDALONE_FLASH_PAGE_SIZE) {
+        bool blank = true;
+        for (unsigned int x = page; x < page + STANDALONE_FLASH_PAGE_SIZE; x += 2) {
+            uint8_t low = pgm_read_byte(&standalone_flash[x]);
+            uint8_t high = pgm_read_byte(&standalone_flash[x + 1]);
+            if (low != 0xFF || high != 0xFF) {
+                flash(LOW, x / 2, low);
+                flash(HIGH, x / 2, high);
+                blank = false;
+            }
+        }
+        if (blank) {
+            blank_pages++;
+        } else if (commit(page / 2) != STK_OK) {
+            return STANDALONE_FAILED_FLASH;
+        }
+        prog_lamp(HIGH);
+    }
+
+    for (unsigned int x = 0; x < sizeof(standalone_flash); x += 2) {
+        if (flash_read(LOW, x / 2) != pgm_read_byte(&standalone_flash[x]) ||
+            flash_read(HIGH, x / 2) != pgm_read_byte(&standalone_flash[x + 1])) {
+            return STANDALONE_FAILED_VERIFY;
+        }
+    }
+
+    // blocks of address (MSB first), length, data until a length of 0
+    const uint8_t* block = standalone_eeprom;
+    uint8_t length;
+    while ((length = pgm_read_byte(&block[2])) != 0) {
+        unsigned int start = pgm_read_byte(&block[0]) * 256 + pgm_read_byte(&block[1]);
+        memcpy_P(buff, &block[3], length);
+        if (write_eeprom_chunk(start, length) != STK_OK) {
+            return STANDALONE_FAILED_EEPROM;
+        }
+        for (unsigned int x = 0; x < length; x++) {
+            unsigned int addr = start + x;
+            if (spi_transaction(0xA0, (addr >> 8) & 0xFF, addr & 0xFF, 0xFF) != buff[x]) {
+                return STANDALONE_FAILED_EEPROM;
+            }
+        }
+        block += 3 + length;
+    }
+
+    // last, a new clock selection only takes effect after the next reset anyway
+    for (uint8_t i = 0; i < sizeof(fuses); i++) {
+        spi_transaction(0xAC, fuse_write[i], 0x00, fuses[i]);
+        if (!wait_ready() || spi_transaction(fuse_read[i][0], fuse_read[i][1], 0x00, 0x00) != fuses[i]) {
+            return STANDALONE_FAILED_FUSES;
+        }
+    }
+    return STANDALONE_PASSED;
+}
+
+// true once per press, after the button was released
+bool standalone_button() {
+    static bool armed = false;
+    static int last_level = HIGH;
+    static unsigned long change_time = 0;
+    int level = digitalRead(BUTTON);
+    if (level != last_level) {
+        last_level = level;
+        change_time = millis();
+    } else if ((millis() - change_time) >= BUTTON_DEBOUNCE) {
+        if (level == HIGH) {
+            armed = true;
+        } else if (armed) {
+            armed = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
+
 // this provides a heartbeat on pin 9, so you can tell the software is running.
 uint8_t hbval = 128;
 int8_t hbdelta = 8;
@@ -725,6 +1295,9 @@ void reset_target(bool reset) {
 
 void setup() {
     SERIAL.begin(BAUDRATE);
+#if STK500_VERSION == 2
+    stk500v2_init(&v2_session);
+#endif
 
     pinMode(LED_PMODE, OUTPUT);
     pulse(LED_PMODE, 2);
@@ -732,14 +1305,24 @@ void setup() {
     pulse(LED_ERR, 2);
     pinMode(LED_HB, OUTPUT);
     pulse(LED_HB, 2);
+#ifdef STANDALONE
+    pinMode(BUTTON, INPUT_PULLUP);
+#endif
 }
 
 void loop(void) {
-    // is pmode active?
+    // is pmode active? (briefly off after each page write)
     if (pmode) {
-        digitalWrite(LED_PMODE, HIGH);
+        if ((millis() - prog_lamp_time) >= PTIME) {
+            digitalWrite(LED_PMODE, HIGH);
+        }
     } else {
+#ifdef STANDALONE
+        // the last standalone programming passed
+        digitalWrite(LED_PMODE, standalone_passed ? HIGH : LOW);
+#else
         digitalWrite(LED_PMODE, LOW);
+#endif
     }
     // is there an error?
     if (ISPError) {
@@ -750,7 +1333,16 @@ void loop(void) {
 
     // light the heartbeat LED
     heartbeat();
+#ifdef STANDALONE
+    if (!pmode && standalone_button()) {
+        standalone();
+    }
+#endif
     if (SERIAL.available()) {
+#if STK500_VERSION == 2
+        stk500v2();
+#else
         avrisp();
+#endif
     }
 }
@@ -0,0 +1,190 @@
+/// @file eeprom_config.h
+/// Versioned, CRC protected configuration block in the internal eeprom.
+/// Read in one burst at startup. If the block is missing or corrupted, the compiled defaults are used.
+/// The legacy clock calibration at @ref EEPROM_ADDR_CLOCK_CALIB_3_MSB is used whenever the block in use has no
+/// clock calibration of its own, see @ref eeprom_config_legacy_calibration.
+/// Shared between the firmware and the host tools in the folder `tools`.
+/// @author JF
+/// @date May 10, 2023
+#ifndef EEPROM_CONFIG_H
+#define EEPROM_CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "eeprom_layout.h"
+#include "time_switch.h"
+
+/// The first byte of a configuration block.
+#define EEPROM_CONFIG_MAGIC_NUMBER 0xC5u
+
+/// The layout version of the configuration block. Increment on every layout change and keep reading
+/// the previous versions, so devices in the field keep their configuration after a firmware update.
+#define EEPROM_CONFIG_VERSION 2u
+
+/// The size of a version 1 block: without the two point clock calibration, followed by the crc.
+#define EEPROM_CONFIG_V1_SIZE 24u
+
+/// Configuration flags.
+enum eeprom_config_flags {
+    /// The clock calibration value is valid and is applied to the timing.
+    EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION = 0x01u,
+    /// Write the event log.
+    EEPROM_CONFIG_FLAG_EVENT_LOG = 0x02u,
+    /// Interpolate the clock calibration between two points with the temperature sensor (version 2).
+    EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION = 0x04u,
+};
+
+/// The configuration block. Multi-byte values are stored little-endian (avr native).
+/// All members are naturally aligned, so the host tools see the same layout without packing.
+typedef struct eeprom_config {
+    uint8_t magic_number;
+    uint8_t version;
+
+    /// Combination of @ref eeprom_config_flags.
+    uint8_t flags;
+    uint8_t reserved;
+
+    /// The measured sleep clock frequency in Hz.
+    uint32_t clock_calibration;
+
+    /// The timing values and undervoltage thresholds for both jumper settings.
+    time_switch_parameters_t parameters;
+
+    /// Version 2: the two point clock calibration. The first point is
+    /// (calibration_sensor_low, clock_calibration), the second (calibration_sensor_high, clock_calibration_high).
+    /// A version 1 block ends with its crc in place of calibration_sensor_low.
+    uint16_t calibration_sensor_low;
+    uint16_t calibration_sensor_high;
+    uint32_t clock_calibration_high;
+
+    /// Unused, zero.
+    uint16_t spare;
+
+    /// CRC-16/CCITT-FALSE over all preceding bytes.
+    uint16_t crc;
+} eeprom_config_t;
+
+static_assert(sizeof(eeprom_config_t) == 32u, "The eeprom configuration layout must not depend on the compiler.");
+static_assert(sizeof(eeprom_config_t) <= (EEPROM_ADDR_CONFIG_END - EEPROM_ADDR_CONFIG), "Configuration block too big.");
+
+/// Continue a CRC-16/CCITT-FALSE calculation (polynomial 0x1021) over more data.
+///
+/// @param crc The crc of the preceding data, 0xFFFF for the first block.
+/// @param data The data.
+/// @param length The amount of bytes.
+/// @return The crc.
+static inline uint16_t eeprom_crc16_update(uint16_t crc, const uint8_t* data, uint16_t length) {
+    while (length-- > 0u) {
+        crc ^= (uint16_t)(*data++) << 8u;
+        for (uint8_t bit_index = 0u; bit_index < 8u; bit_index++) {
+            crc = (crc & 0x8000u) ? (uint16_t)((crc << 1u) ^ 0x1021u) : (uint16_t)(crc << 1u);
+        }
+    }
+
+    return crc;
+}
+
+/// Calculate the CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF).
+///
+/// @param data The data.
+/// @param length The amount of bytes.
+/// @return The crc.
+static inline uint16_t eeprom_crc16(const uint8_t* data, uint16_t length) {
+    return eeprom_crc16_update(0xFFFFu, data, length);
+}
+
+/// Calculate the crc of a configuration block.
+///
+/// @param config The configuration block.
+/// @return The crc to store in the block.
+static inline uint16_t eeprom_config_crc(const eeprom_config_t* config) {
+    return eeprom_crc16((const uint8_t*)config, sizeof(eeprom_config_t) - sizeof(config->crc));
+}
+
+/// Get the two point clock calibration of a configuration block.
+///
+/// @param config The configuration block.
+/// @param points The calibration points.
+static inline void eeprom_config_calibration_points(const eeprom_config_t* config, clock_calibration_points_t* points) {
+    points->sensor_low = config->calibration_sensor_low;
+    points->sensor_high = config->calibration_sensor_high;
+    points->clock_calibration_low = config->clock_calibration;
+    points->clock_calibration_high = config->clock_calibration_high;
+}
+
+/// Check magic number, version and crc of a configuration block as well as the range of the parameters.
+/// Version 1 blocks are accepted, see @ref eeprom_config_upgrade.
+///
+/// @param config The configuration block.
+/// @return True if the block can be used.
+static inline bool eeprom_config_valid(const eeprom_config_t* config) {
+    const uint8_t* block = (const uint8_t*)config;
+
+    if (config->magic_number != EEPROM_CONFIG_MAGIC_NUMBER || !time_switch_parameters_valid(&config->parameters)) {
+        return false;
+    }
+
+    if (config->version == 1u) {
+        uint16_t crc = (uint16_t)block[EEPROM_CONFIG_V1_SIZE - 2u] | ((uint16_t)block[EEPROM_CONFIG_V1_SIZE - 1u] << 8u);
+        return crc == eeprom_crc16(block, EEPROM_CONFIG_V1_SIZE - sizeof(config->crc));
+    }
+
+    clock_calibration_points_t points;
+    eeprom_config_calibration_points(config, &points);
+    return (config->version == EEPROM_CONFIG_VERSION) && (config->crc == eeprom_config_crc(config)) &&
+           (!(config->flags & EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION) || clock_calibration_points_valid(&points));
+}
+
+/// Convert a valid block of a previous version to the current layout.
+///
+/// @param config The valid configuration block.
+static inline void eeprom_config_upgrade(eeprom_config_t* config) {
+    if (config->version == 1u) {
+        config->version = EEPROM_CONFIG_VERSION;
+        config->flags &= (uint8_t)~EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION;
+        config->calibration_sensor_low = 0u;
+        config->calibration_sensor_high = 0u;
+        config->clock_calibration_high = 0u;
+        config->spare = 0u;
+        config->crc = eeprom_config_crc(config);
+    }
+}
+
+/// Fill in a valid configuration block with the compiled defaults and without clock calibration.
+///
+/// @param config The configuration block.
+static inline void eeprom_config_defaults(eeprom_config_t* config) {
+    config->magic_number = EEPROM_CONFIG_MAGIC_NUMBER;
+    config->version = EEPROM_CONFIG_VERSION;
+    config->flags = EEPROM_CONFIG_FLAG_EVENT_LOG;
+    config->reserved = 0u;
+    config->clock_calibration = 0u;
+    time_switch_default_parameters(&config->parameters);
+    config->calibration_sensor_low = 0u;
+    config->calibration_sensor_high = 0u;
+    config->clock_calibration_high = 0u;
+    config->spare = 0u;
+    config->crc = eeprom_config_crc(config);
+}
+
+/// Take the clock calibration from the legacy record if the block has none of its own. The record is the per chip
+/// calibration of fleet_calibration, a profile without `--calibration` written on top of it must not discard it.
+///
+/// @param config The configuration block in use, valid or the defaults. Only changed in ram, the crc isn't updated.
+/// @param record The legacy record, @ref EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER + 1 bytes from @ref EEPROM_ADDR_CLOCK_CALIB_3_MSB.
+/// @return True if the legacy calibration is used.
+static inline bool eeprom_config_legacy_calibration(eeprom_config_t* config, const uint8_t* record) {
+    if ((config->flags & EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION) ||
+        record[EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER] != EEPROM_CLOCK_CALIB_MAGIC_NUMBER) {
+        return false;
+    }
+
+    config->flags |= EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION;
+    config->clock_calibration = ((uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_3_MSB] << 24u) |
+                                ((uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_2] << 16u) |
+                                ((uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_1] << 8u) |
+                                (uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_0_LSB];
+    return true;
+}
+
+#endif // EEPROM_CONFIG_H
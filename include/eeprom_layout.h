@@ -0,0 +1,87 @@
+/// @file eeprom_layout.h
+/// The layout of the 512B internal eeprom.
+/// Shared between the firmware and the host tools in the folder `tools`.
+/// @author JF
+/// @date May 10, 2023
+///
+/// Address map:
+///   0x000-0x004: Clock calibration, big-endian, followed by @ref EEPROM_CLOCK_CALIB_MAGIC_NUMBER.
+///   0x005-0x006: Stack headroom, big-endian (only written with STACK_WATERMARK_MODE).
+///   0x010-0x02F: Configuration block, see `eeprom_config.h`.
+///   0x040-0x07F: Schedule checkpoint, wear leveled ring of @ref EEPROM_CHECKPOINT_RECORDS records.
+///   0x080-0x0FF: Lifetime statistics, wear leveled ring of @ref EEPROM_LIFETIME_STATS_RECORDS records.
+///   0x100-0x1FF: Event log, wear leveled ring of @ref EEPROM_EVENT_LOG_RECORDS records.
+///
+/// Wear leveled rings:
+/// Every slot starts with a sequence number counting 0..254, 0xFF marks an erased slot. The newest slot is the
+/// last one before the first break in the sequence. A slot is written by erasing the sequence number, writing
+/// the payload and finally writing the new sequence number, so an interrupted write never yields a valid record.
+#ifndef EEPROM_LAYOUT_H
+#define EEPROM_LAYOUT_H
+
+/// Possibility to store calibration values in eeprom memory.
+enum eeprom_addresses {
+    EEPROM_ADDR_CLOCK_CALIB_3_MSB = 0x0u,
+    EEPROM_ADDR_CLOCK_CALIB_2,
+    EEPROM_ADDR_CLOCK_CALIB_1,
+    EEPROM_ADDR_CLOCK_CALIB_0_LSB,
+    EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER,
+    EEPROM_ADDR_STACK_HEADROOM_MSB,
+    EEPROM_ADDR_STACK_HEADROOM_LSB,
+
+    EEPROM_ADDR_CONFIG = 0x10u,
+    EEPROM_ADDR_CONFIG_END = 0x30u,
+
+    EEPROM_ADDR_CHECKPOINT = 0x40u,
+
+    EEPROM_ADDR_LIFETIME_STATS = 0x80u,
+
+    EEPROM_ADDR_EVENT_LOG = 0x100u,
+};
+
+// The magic number that must be present in the eeprom to apply the clock calibration algorithm.
+#define EEPROM_CLOCK_CALIB_MAGIC_NUMBER 0xCDu
+
+/// The size of the internal eeprom.
+#define EEPROM_SIZE_BYTES 512u
+
+/// The sequence number of an erased ring slot. Valid sequence numbers count from 0 to 254.
+#define EEPROM_RING_SEQUENCE_ERASED 0xFFu
+#define EEPROM_RING_SEQUENCE_MODULO 255u
+
+/// Schedule checkpoint record: sequence number, @ref checkpoint_flags, wakeup count of the load feature (big-endian).
+#define EEPROM_CHECKPOINT_RECORD_SIZE 4u
+#define EEPROM_CHECKPOINT_RECORDS 16u
+
+/// The flags of a schedule checkpoint record.
+enum checkpoint_flags {
+    /// The wake state is @ref STATE_LOAD_OFF.
+    CHECKPOINT_FLAG_LOAD_OFF = 0x01u,
+    /// The 12V/24V jumper selected 12V.
+    CHECKPOINT_FLAG_12V = 0x02u,
+    /// The feature jumper selected all features.
+    CHECKPOINT_FLAG_ALL_FEATURES = 0x04u,
+};
+
+/// Lifetime statistics record: sequence number followed by (little-endian, avr native):
+///   uint16_t lowest battery voltage (10 bit adc value), uint16_t highest battery voltage,
+///   uint32_t wakeups with the load on, uint32_t battery measurements, uint16_t undervoltage trips,
+///   uint8_t resets (saturating).
+#define EEPROM_LIFETIME_STATS_RECORD_SIZE 16u
+#define EEPROM_LIFETIME_STATS_RECORDS 8u
+
+/// Event log record: sequence number, @ref event_log_types, 16-bit data (big-endian).
+#define EEPROM_EVENT_LOG_RECORD_SIZE 4u
+#define EEPROM_EVENT_LOG_RECORDS 64u
+
+/// The types of the event log records.
+enum event_log_types {
+    /// Device came out of reset. Data: reset flags from MCUSR (PORF, EXTRF, BORF, WDRF).
+    EVENT_LOG_RESET = 1u,
+    /// Undervoltage protection disabled the load. Data: battery voltage as a 10 bit value.
+    EVENT_LOG_UNDERVOLTAGE_TRIP,
+    /// The load was switched on by the time switch. Data: load on/off cycles since the last reset.
+    EVENT_LOG_LOAD_CYCLES,
+};
+
+#endif // EEPROM_LAYOUT_H
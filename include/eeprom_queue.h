@@ -0,0 +1,54 @@
+/// @file eeprom_queue.h
+/// Every persistent write (event log, checkpoint, calibration, ...) is queued in ram and only written by
+/// @ref eeprom_queue_flush, which the firmware calls right after a battery measurement above the undervoltage
+/// threshold plus @ref EEPROM_QUEUE_FLUSH_MARGIN_ADC. An eeprom write draws several mA for ~3.4ms per byte,
+/// doing it on a sagging supply risks corrupting the eeprom.
+///
+/// The queue only holds pointers to the data, the data itself is read at flush time. Queueing the same data
+/// again before the flush coalesces both writes, and every flush skips the bytes that already hold the value.
+/// @author JF
+/// @date May 10, 2023
+#ifndef EEPROM_QUEUE_H
+#define EEPROM_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "eeprom_ring.h"
+
+/// The maximum amount of pending writes.
+#define EEPROM_QUEUE_ENTRIES 8u
+
+/// The margin above the undervoltage threshold required to flush the queue (~0.5V for 12V, ~1V for 24V).
+#define EEPROM_QUEUE_FLUSH_MARGIN_ADC 36u
+
+/// Queue a new record for a wear leveled ring.
+///
+/// @param ring The initialized ring.
+/// @param payload The slot_size - 1 payload bytes, must stay valid until the flush.
+/// @return False if the queue is full and the write was dropped.
+bool eeprom_queue_ring(eeprom_ring_t* ring, const uint8_t* payload);
+
+/// Queue a write to a fixed eeprom address.
+///
+/// @param address The eeprom address.
+/// @param source The data, must stay valid until the flush.
+/// @param length The amount of bytes.
+/// @return False if the queue is full and the write was dropped.
+bool eeprom_queue_block(uint16_t address, const uint8_t* source, uint8_t length);
+
+/// Check if data is waiting for the next flush.
+///
+/// @param source The data as passed to @ref eeprom_queue_ring or @ref eeprom_queue_block.
+/// @return True if the data is queued.
+bool eeprom_queue_pending(const uint8_t* source);
+
+/// Check if any write is waiting for the next flush.
+///
+/// @return True if the queue is empty.
+bool eeprom_queue_empty(void);
+
+/// Write all queued data in the order it was queued with @ref eeprom_writer_write. Must only be called while the
+/// supply is good.
+void eeprom_queue_flush(void);
+
+#endif // EEPROM_QUEUE_H
@@ -0,0 +1,43 @@
+/// @file eeprom_ring.h
+/// Wear leveled ring of fixed size records in the internal eeprom, see @ref eeprom_layout.h for the slot format.
+/// @author JF
+/// @date May 10, 2023
+#ifndef EEPROM_RING_H
+#define EEPROM_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// A ring of slots, each holding a sequence number followed by the payload.
+typedef struct eeprom_ring {
+    /// Address of the first slot.
+    uint16_t address;
+
+    /// Size of a slot including the sequence number.
+    uint8_t slot_size;
+    uint8_t slot_count;
+
+    /// The slot and the sequence number of the next record, set up by @ref eeprom_ring_init.
+    uint8_t next_slot;
+    uint8_t next_sequence;
+} eeprom_ring_t;
+
+/// Find the newest record of the ring.
+///
+/// @param ring The ring with address, slot size and slot count filled in.
+void eeprom_ring_init(eeprom_ring_t* ring);
+
+/// Read the payload of the newest record.
+///
+/// @param ring The initialized ring.
+/// @param payload Buffer for slot_size - 1 bytes.
+/// @return True if the ring holds a record.
+bool eeprom_ring_read_newest(const eeprom_ring_t* ring, uint8_t* payload);
+
+/// Write a new record, overwriting the oldest one. Sleeps in idle mode while the eeprom is written.
+///
+/// @param ring The initialized ring.
+/// @param payload The slot_size - 1 payload bytes.
+void eeprom_ring_append(eeprom_ring_t* ring, const uint8_t* payload);
+
+#endif // EEPROM_RING_H
@@ -0,0 +1,22 @@
+/// @file eeprom_writer.h
+/// Interrupt driven eeprom writes. Instead of spinning on EEPE for ~3.4ms per byte like the avr-libc and Arduino
+/// eeprom functions, the next byte is started from the EE_RDY interrupt and the cpu waits in idle sleep mode.
+///
+/// Bytes that already hold the value are skipped. A byte that only needs bits cleared is programmed in write
+/// only mode and a byte set to 0xFF in erase only mode, both take ~1.8ms instead of ~3.4ms (pg. 19).
+/// @author JF
+/// @date May 10, 2023
+#ifndef EEPROM_WRITER_H
+#define EEPROM_WRITER_H
+
+#include <stdint.h>
+
+/// Write a block to the eeprom and return once the last byte is programmed. Sleeps in idle mode in between,
+/// the sleep mode has to be set up again before the next power down sleep.
+///
+/// @param address The eeprom address.
+/// @param source The data.
+/// @param length The amount of bytes.
+void eeprom_writer_write(uint16_t address, const uint8_t* source, uint8_t length);
+
+#endif // EEPROM_WRITER_H
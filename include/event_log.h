@@ -0,0 +1,35 @@
+/// @file event_log.h
+/// Append-only event log in the internal eeprom for units coming back from the field.
+/// Events are collected in the eeprom queue (`eeprom_queue.h`) and written in one batch
+/// with the next flush, so the eeprom is written only a few times a day.
+///
+/// Endurance: 64 slots of 100k write cycles each hold 6.4M records, i.e. more than 10 years
+/// even with a record every few minutes. At one record per day a slot is rewritten every 64 days.
+/// @author JF
+/// @date May 10, 2023
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "eeprom_layout.h"
+
+/// The amount of events that can wait in ram for the next flush of the eeprom queue.
+#define EVENT_LOG_PENDING_MAX 4u
+
+/// Log the load cycles every n-th time the time switch switches on the load (every 8 days with the 12/24V timing).
+#define EVENT_LOG_LOAD_CYCLES_BATCH 8u
+
+/// Find the end of the log in the eeprom. Must be called before any other event log function.
+///
+/// @param enabled False to discard all events.
+void event_log_init(bool enabled);
+
+/// Queue an event in ram. A pending @ref EVENT_LOG_LOAD_CYCLES event is replaced by a newer one.
+/// If more than @ref EVENT_LOG_PENDING_MAX events are pending, the oldest one is replaced.
+///
+/// @param type One of @ref event_log_types.
+/// @param data The event data.
+void event_log_add(uint8_t type, uint16_t data);
+
+#endif // EVENT_LOG_H
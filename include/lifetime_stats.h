@@ -0,0 +1,47 @@
+/// @file lifetime_stats.h
+/// Lifetime statistics for sizing the battery and the load: lowest and highest battery voltage, time with the
+/// load on, number of measurements, undervoltage trips and resets. Counted in ram and queued for the eeprom
+/// once a day and on every undervoltage trip. A reset loses at most the counts of the last day.
+///
+/// Queued records are only written once the battery is above the undervoltage threshold plus
+/// @ref EEPROM_QUEUE_FLUSH_MARGIN_ADC (see eeprom_queue.h). The trips of a unit whose battery never recovered
+/// before it lost its supply are therefore missing from an eeprom dump, the same as the rest of that day.
+///
+/// Endurance: one record of up to 16 byte writes per day, 8 slots are each rewritten every 8 days.
+/// @author JF
+/// @date May 10, 2023
+#ifndef LIFETIME_STATS_H
+#define LIFETIME_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "eeprom_layout.h"
+
+/// 24h: The amount of wakeup cycles between two records (8.192s per cycle). 24*3600/8.192.
+#define LIFETIME_STATS_INTERVAL_CYCLES 10547u
+
+/// The lifetime statistics, stored as payload of a lifetime statistics record (see `eeprom_layout.h`).
+typedef struct lifetime_stats {
+    uint16_t battery_voltage_min;
+    uint16_t battery_voltage_max;
+    uint32_t load_on_wakeups;
+    uint32_t measurement_count;
+    uint16_t undervoltage_trip_count;
+    uint8_t reset_count;
+} lifetime_stats_t;
+
+/// Continue the statistics from the newest record in the eeprom and count the reset.
+void lifetime_stats_init(void);
+
+/// Count a battery measurement.
+///
+/// @param battery_voltage The battery voltage as a 10 bit value.
+/// @param undervoltage_trip True if the measurement triggered the undervoltage protection.
+void lifetime_stats_measurement(uint16_t battery_voltage, bool undervoltage_trip);
+
+/// Count a wakeup and queue a record once a day.
+///
+/// @param load_enabled True if the load is on.
+void lifetime_stats_wakeup(bool load_enabled);
+
+#endif // LIFETIME_STATS_H
@@ -0,0 +1,57 @@
+/// @file stack_watermark.h
+/// Hardware independent part of the stack high-water mark (`STACK_WATERMARK_MODE` in `main.cpp`): the free ram is
+/// painted with @ref STACK_CANARY at startup, the stack grows down from the top of the ram into it. The painted bytes
+/// that are still intact above the static variables are the headroom that was never used. The host tool
+/// `tools/stack_watermark_check.cpp` runs the very same scan over painted buffers.
+/// @author JF
+/// @date May 10, 2023
+#ifndef STACK_WATERMARK_H
+#define STACK_WATERMARK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// The pattern the unused ram is painted with.
+#define STACK_CANARY 0xC5u
+
+/// Paint the ram, both ends included. The firmware does the same in assembler from .init1, before any C code runs.
+///
+/// @param bottom The first byte after the static variables.
+/// @param top The top of the ram, where the stack starts.
+static inline void stack_watermark_paint(uint8_t* bottom, uint8_t* top) {
+    while (bottom <= top) {
+        *bottom++ = STACK_CANARY;
+    }
+}
+
+/// Count the painted bytes the stack has never touched, from the bottom up to the first overwritten byte.
+/// A stack byte that happens to equal @ref STACK_CANARY at the deepest point is counted as headroom.
+///
+/// @param bottom The first byte after the static variables.
+/// @param top The top of the ram.
+/// @return The stack headroom in bytes.
+static inline uint16_t stack_watermark_headroom(const uint8_t* bottom, const uint8_t* top) {
+    uint16_t headroom = 0u;
+
+    while ((bottom <= top) && (*bottom == STACK_CANARY)) {
+        bottom++;
+        headroom++;
+    }
+
+    return headroom;
+}
+
+/// Keep the smallest headroom.
+///
+/// @param headroom_min The smallest headroom so far, UINT16_MAX before the first scan.
+/// @param headroom The headroom of the current scan.
+/// @return True if the headroom decreased and must be stored.
+static inline bool stack_watermark_update(uint16_t* headroom_min, uint16_t headroom) {
+    if (headroom >= *headroom_min) {
+        return false;
+    }
+    *headroom_min = headroom;
+    return true;
+}
+
+#endif // STACK_WATERMARK_H
@@ -0,0 +1,307 @@
+/// @file time_switch.h
+/// Hardware independent load switching logic of the time switch.
+/// The firmware advances it once per watchdog wakeup. The host tools in the folder `tools`
+/// run the very same code against recorded or synthetic supply voltage traces.
+/// @author JF
+/// @date May 10, 2023
+#ifndef TIME_SWITCH_H
+#define TIME_SWITCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "time_switch_config.h"
+
+/// The states of the regular load on/off feature.
+typedef enum wake_states {
+    STATE_LOAD_ON,
+    STATE_LOAD_OFF,
+} wake_states_t;
+
+/// The tunable timing values and undervoltage thresholds for both jumper settings.
+/// Either the compiled defaults from `time_switch_config.h` or read from the eeprom configuration.
+typedef struct time_switch_parameters {
+    uint16_t timing_cycles_load_on_12v;
+    uint16_t timing_cycles_load_off_12v;
+    uint16_t timing_cycles_load_on_24v;
+    uint16_t timing_cycles_load_off_24v;
+    uint16_t adc_threshold_12v;
+    uint16_t adc_threshold_24v;
+} time_switch_parameters_t;
+
+/// A two point clock calibration: the sleep clock frequency measured at two readings of the internal temperature sensor.
+typedef struct clock_calibration_points {
+    /// The raw temperature sensor readings of both points, sensor_low < sensor_high.
+    uint16_t sensor_low;
+    uint16_t sensor_high;
+
+    /// The sleep clock frequency in Hz at both points.
+    uint32_t clock_calibration_low;
+    uint32_t clock_calibration_high;
+} clock_calibration_points_t;
+
+/// The parameters selected by the jumpers and the clock calibration. Fixed after startup,
+/// except for the calibrated timing with a two point clock calibration.
+typedef struct time_switch_config {
+    /// All features active or only the undervoltage protection is active. Selectable by a jumper.
+    bool all_features_activated;
+
+    /// The uncalibrated timing for the load on/off feature with the selectable 12/24V jumper.
+    uint16_t timing_cycles_load_on_nominal;
+    uint16_t timing_cycles_load_off_nominal;
+
+    /// The timing with the clock calibration applied.
+    uint16_t timing_cycles_load_on;
+    uint16_t timing_cycles_load_off;
+
+    /// The raw adc threshold under which to disable the load.
+    uint16_t undervoltage_adc_threshold;
+} time_switch_config_t;
+
+/// The runtime state, advanced once per wakeup.
+typedef struct time_switch_state {
+    uint16_t wakeup_count_load_feature;
+    uint16_t wakeup_count_undervoltage_protection;
+    bool undervoltage_protection_triggered;
+    bool load_enabled;
+
+    /// One of @ref wake_states_t.
+    uint8_t wake_state;
+} time_switch_state_t;
+
+static_assert(SLEEP_CLOCK_DEVIATION_MAX_HZ * 0xFFFFlu + SLEEP_CLOCK_VALUE_HZ <= 0xFFFFFFFFlu,
+              "The scaled clock deviation must fit 32 bits.");
+
+/// Apply the clock calibration calculation to obtain a more precise sleep timing behaviour.
+/// The result is `(clock_calibration * uncalibrated_value) / SLEEP_CLOCK_VALUE_HZ`, but only the deviation from
+/// @ref SLEEP_CLOCK_VALUE_HZ is multiplied: the product stays below 2^31 for every 16 bit value, the full product
+/// would overflow 32 bits above ~27000 wakeups.
+///
+/// @param clock_calibration The clock calibration read from the eeprom.
+/// @param uncalibrated_value The uncalibrated value, 16 bits.
+/// @return The calibrated value.
+static inline uint32_t apply_clock_calibration(uint32_t clock_calibration, uint32_t uncalibrated_value) {
+    // Discard too high or too low calibration values.
+    if ((clock_calibration < (SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ)) ||
+        clock_calibration > (SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ)) {
+        return uncalibrated_value;
+    }
+
+    // Rounded down like the full product: a slower clock subtracts the rounded up share.
+    if (clock_calibration >= SLEEP_CLOCK_VALUE_HZ) {
+        return uncalibrated_value + ((clock_calibration - SLEEP_CLOCK_VALUE_HZ) * uncalibrated_value) / SLEEP_CLOCK_VALUE_HZ;
+    }
+    return uncalibrated_value -
+           ((SLEEP_CLOCK_VALUE_HZ - clock_calibration) * uncalibrated_value + SLEEP_CLOCK_VALUE_HZ - 1u) / SLEEP_CLOCK_VALUE_HZ;
+}
+
+/// Interpolate the clock calibration linearly between two calibration points. Readings outside of both points
+/// are clamped to the nearest point, extrapolating from two close points could amplify the sensor noise.
+/// Unsigned fixed point: the frequency difference fits 17 bits, times the 10 bit sensor offset it fits 32 bits.
+///
+/// @param points The valid calibration points.
+/// @param sensor The raw temperature sensor reading.
+/// @return The clock calibration in Hz, rounded.
+static inline uint32_t interpolate_clock_calibration(const clock_calibration_points_t* points, uint16_t sensor) {
+    if (sensor <= points->sensor_low) {
+        return points->clock_calibration_low;
+    }
+    if (sensor >= points->sensor_high) {
+        return points->clock_calibration_high;
+    }
+
+    uint32_t offset = sensor - points->sensor_low;
+    uint32_t span = points->sensor_high - points->sensor_low;
+    if (points->clock_calibration_high >= points->clock_calibration_low) {
+        return points->clock_calibration_low +
+               ((points->clock_calibration_high - points->clock_calibration_low) * offset + span / 2u) / span;
+    }
+    return points->clock_calibration_low -
+           ((points->clock_calibration_low - points->clock_calibration_high) * offset + span / 2u) / span;
+}
+
+/// Check that two calibration points can be interpolated: distinct sensor readings within the 10 bit adc range
+/// and both frequencies accepted by @ref apply_clock_calibration.
+///
+/// @param points The calibration points.
+/// @return True if the points can be used.
+static inline bool clock_calibration_points_valid(const clock_calibration_points_t* points) {
+    const uint32_t frequencies[] = {points->clock_calibration_low, points->clock_calibration_high};
+
+    for (uint8_t point = 0u; point < (sizeof(frequencies) / sizeof(frequencies[0])); point++) {
+        if (frequencies[point] < (SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ) ||
+            frequencies[point] > (SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ)) {
+            return false;
+        }
+    }
+
+    return (points->sensor_low < points->sensor_high) && (points->sensor_high <= 1023u);
+}
+
+/// Fill in the compiled default parameters.
+///
+/// @param parameters The parameters to fill in.
+static inline void time_switch_default_parameters(time_switch_parameters_t* parameters) {
+    parameters->timing_cycles_load_on_12v = TIMING_CYCLES_LOAD_ON_12V;
+    parameters->timing_cycles_load_off_12v = TIMING_CYCLES_LOAD_OFF_12V;
+    parameters->timing_cycles_load_on_24v = TIMING_CYCLES_LOAD_ON_24V;
+    parameters->timing_cycles_load_off_24v = TIMING_CYCLES_LOAD_OFF_24V;
+    parameters->adc_threshold_12v = ADC_BATTERY_THRESHOLD_12v;
+    parameters->adc_threshold_24v = ADC_BATTERY_THRESHOLD_24v;
+}
+
+/// Check that the parameters are in range: the timing values between 1 and @ref TIMING_CYCLES_MAX wakeups,
+/// the thresholds within the 10 bit adc range.
+///
+/// @param parameters The parameters to check.
+/// @return True if the parameters can be used.
+static inline bool time_switch_parameters_valid(const time_switch_parameters_t* parameters) {
+    const uint16_t timings[] = {parameters->timing_cycles_load_on_12v, parameters->timing_cycles_load_off_12v,
+                                parameters->timing_cycles_load_on_24v, parameters->timing_cycles_load_off_24v};
+
+    for (uint8_t timing = 0u; timing < (sizeof(timings) / sizeof(timings[0])); timing++) {
+        if (timings[timing] == 0u || timings[timing] > TIMING_CYCLES_MAX) {
+            return false;
+        }
+    }
+
+    return (parameters->adc_threshold_12v <= 1023u) && (parameters->adc_threshold_24v <= 1023u);
+}
+
+/// Apply a new clock calibration to the nominal timing, e.g. interpolated from two calibration points.
+/// A running on/off phase ends with the new timing.
+///
+/// @param config The configuration, set up by @ref time_switch_configure.
+/// @param clock_calibration The clock calibration in Hz.
+static inline void time_switch_calibrate(time_switch_config_t* config, uint32_t clock_calibration) {
+    config->timing_cycles_load_on = apply_clock_calibration(clock_calibration, config->timing_cycles_load_on_nominal);
+    config->timing_cycles_load_off = apply_clock_calibration(clock_calibration, config->timing_cycles_load_off_nominal);
+}
+
+/// Derive the timing and the undervoltage threshold from the jumper settings.
+///
+/// @param config The configuration to fill in.
+/// @param parameters The timing values and thresholds for both jumper settings.
+/// @param all_features_activated True: all features, false: only undervoltage protection.
+/// @param _12_24V_selection True: 12V timing, false: 24V timing.
+/// @param clock_calibration_present True if a clock calibration is stored in the eeprom.
+/// @param clock_calibration The clock calibration read from the eeprom.
+static inline void time_switch_configure(time_switch_config_t* config, const time_switch_parameters_t* parameters,
+                                         bool all_features_activated, bool _12_24V_selection,
+                                         bool clock_calibration_present, uint32_t clock_calibration) {
+    config->all_features_activated = all_features_activated;
+
+    // Apply the correct timing.
+    config->timing_cycles_load_on_nominal = (_12_24V_selection == true) ? parameters->timing_cycles_load_on_12v
+                                                                        : parameters->timing_cycles_load_on_24v;
+    config->timing_cycles_load_off_nominal = (_12_24V_selection == true) ? parameters->timing_cycles_load_off_12v
+                                                                         : parameters->timing_cycles_load_off_24v;
+    config->undervoltage_adc_threshold = (_12_24V_selection == true) ? parameters->adc_threshold_12v
+                                                                     : parameters->adc_threshold_24v;
+
+    // Check whether to apply a clock calibration, if yes adjust the timing values accordingly.
+    config->timing_cycles_load_on = config->timing_cycles_load_on_nominal;
+    config->timing_cycles_load_off = config->timing_cycles_load_off_nominal;
+    if (clock_calibration_present) {
+        time_switch_calibrate(config, clock_calibration);
+    }
+}
+
+/// Reset the state to the power-up default: counters at zero and the load on.
+///
+/// @param state The state to initialize.
+static inline void time_switch_init(time_switch_state_t* state) {
+    state->wakeup_count_load_feature = 0u;
+    state->wakeup_count_undervoltage_protection = 0u;
+    state->undervoltage_protection_triggered = false;
+    state->load_enabled = true;
+    state->wake_state = STATE_LOAD_ON;
+}
+
+/// Continue the load on/off schedule at a saved phase.
+///
+/// @param state The initialized state.
+/// @param wake_state The saved @ref wake_states_t.
+/// @param wakeup_count_load_feature The saved wakeups since the last load switching.
+static inline void time_switch_resume(time_switch_state_t* state, uint8_t wake_state,
+                                      uint16_t wakeup_count_load_feature) {
+    state->wake_state = (wake_state == STATE_LOAD_ON) ? STATE_LOAD_ON : STATE_LOAD_OFF;
+    state->load_enabled = (state->wake_state == STATE_LOAD_ON);
+    state->wakeup_count_load_feature = wakeup_count_load_feature;
+}
+
+/// Count a wakeup and check whether the battery voltage must be measured.
+/// The battery voltage is only measured periodically and if the load is active.
+/// Both counters saturate at their maximum value, they never overflow.
+///
+/// @param state The state to advance.
+/// @return True if a battery measurement is due, pass the result to @ref time_switch_battery_measured.
+static inline bool time_switch_wakeup(time_switch_state_t* state) {
+    // Saturate instead of wrapping around. After an undervoltage trip neither counter is reset anymore.
+    if (state->wakeup_count_load_feature != UINT16_MAX) {
+        state->wakeup_count_load_feature++;
+    }
+    if (state->wakeup_count_undervoltage_protection != UINT16_MAX) {
+        state->wakeup_count_undervoltage_protection++;
+    }
+
+    if (state->load_enabled && (state->wakeup_count_undervoltage_protection >= TIMING_CYCLES_BATTERY_MEASUREMENT)) {
+        state->wakeup_count_undervoltage_protection = 0u;
+        return true;
+    }
+
+    return false;
+}
+
+/// Disable the load if the battery voltage falls under the predefined threshold.
+///
+/// @param state The state to update.
+/// @param config The active configuration.
+/// @param battery_voltage The battery voltage as a 10 bit value.
+static inline void time_switch_battery_measured(time_switch_state_t* state, const time_switch_config_t* config,
+                                                uint16_t battery_voltage) {
+    if (battery_voltage < config->undervoltage_adc_threshold) {
+        state->load_enabled = false;
+        state->undervoltage_protection_triggered = true;
+    }
+}
+
+/// If the feature selection jumper is set to all features, enable/disable the load regularly.
+/// If the battery voltage has once fallen under the threshold, never activate the load again.
+///
+/// @param state The state to update.
+/// @param config The active configuration.
+static inline void time_switch_update_load_timing(time_switch_state_t* state, const time_switch_config_t* config) {
+    if (!config->all_features_activated || state->undervoltage_protection_triggered) {
+        return;
+    }
+
+    switch (state->wake_state) {
+    case STATE_LOAD_ON: {
+        if (state->wakeup_count_load_feature >= config->timing_cycles_load_on) {
+            state->wakeup_count_load_feature = 0u;
+            state->load_enabled = false;
+            state->wake_state = STATE_LOAD_OFF;
+        }
+        break;
+    }
+
+    case STATE_LOAD_OFF: {
+        if (state->wakeup_count_load_feature >= config->timing_cycles_load_off) {
+            state->wakeup_count_load_feature = 0u;
+            state->load_enabled = true;
+            state->wake_state = STATE_LOAD_ON;
+        }
+        break;
+    }
+
+    default: {
+        // Recover from a corrupted state with the load off, the wake state and the load must never disagree.
+        state->wakeup_count_load_feature = 0u;
+        state->load_enabled = false;
+        state->wake_state = STATE_LOAD_OFF;
+        break;
+    }
+    }
+}
+
+#endif // TIME_SWITCH_H
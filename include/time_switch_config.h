@@ -0,0 +1,53 @@
+/// @file time_switch_config.h
+/// The timing values and the undervoltage thresholds of the time switch.
+/// Shared between the firmware and the host tools in the folder `tools`.
+/// @author JF
+/// @date May 10, 2023
+#ifndef TIME_SWITCH_CONFIG_H
+#define TIME_SWITCH_CONFIG_H
+
+/// 15min: Battery measurement period. The amount of wakeup cycles corresponding to 15min (8.192s per cycle). 15*60/8.192.
+#define TIMING_CYCLES_BATTERY_MEASUREMENT 110u
+
+/// The 10V equivalent raw adc value under which to disable the load for a 12V device (0-1023u).
+/// R1: 100k, R2: 22k
+/// (Vbat)*(22/122)*(1/2.56V)*1023
+/// (10V)*(22/122)*(1/2.56V)*1023
+#define ADC_BATTERY_THRESHOLD_12v 721u
+
+/// The 20V equivalent raw adc value under which to disable the load for a 24V device ( 0-1023, (Vbat)*(10/110)*(1/2.56V)*1023).
+/// R1: 100k, R2: 10k
+/// (Vbat)*(10/110)*(1/2.56V)*1023 )
+/// (20V)*(10/110)*(1/2.56V)*1023
+#define ADC_BATTERY_THRESHOLD_24v 726u
+
+/// 16h on: 12V. The amount of wakeup cycles corresponding to 8h/28800s for a 12V device (8.192s per cycle). 16*3600/8.192.
+#define TIMING_CYCLES_LOAD_ON_12V 7031u
+/// 8h off: 12V. The amount of wakeup cycles corresponding to 16h/57600s for a 12V device (8.192s per cycle). 8*3600/8.192.
+#define TIMING_CYCLES_LOAD_OFF_12V 3516u
+
+/// 20h on: 24V. The amount of wakeup cycles corresponding to 8h/28800s for a 24V device (8.192s per cycle). 20*3600/8.192.
+#define TIMING_CYCLES_LOAD_ON_24V 8789u
+/// 4h off: 24V. The amount of wakeup cycles corresponding to 16h/57600s for a 24V device (8.192s per cycle). 4*3600/8.192.
+#define TIMING_CYCLES_LOAD_OFF_24V 1758u
+
+/// The voltage dividers of the battery measurement (R1: high side, R2: low side) and the internal adc reference.
+#define VOLTAGE_DIVIDER_R1_OHM 100000lu
+#define VOLTAGE_DIVIDER_R2_12V_OHM 22000lu
+#define VOLTAGE_DIVIDER_R2_24V_OHM 10000lu
+#define ADC_REFERENCE_MV 2560lu
+
+/// The largest timing value that still fits 16 bits after applying the highest accepted clock calibration.
+/// `apply_clock_calibration()` only scales the deviation from 128kHz, its intermediate product can't overflow.
+#define TIMING_CYCLES_MAX ((0xFFFFlu * SLEEP_CLOCK_VALUE_HZ) / (SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ))
+
+/// The value of the 128kHz clock used to clock the sleep watchdog timer.
+#define SLEEP_CLOCK_VALUE_HZ 128000lu
+
+/// The maximum deviation from @ref SLEEP_CLOCK_VALUE_HZ above or below which to discard clock calibration values.
+#define SLEEP_CLOCK_DEVIATION_MAX_HZ 30000lu
+
+/// The amount of sleep clock cycles per watchdog wakeup (8.192s @128kHz).
+#define SLEEP_CLOCK_CYCLES_PER_WAKEUP 1048576lu
+
+#endif // TIME_SWITCH_CONFIG_H
@@ -0,0 +1,49 @@
+/// @file checkpoint.cpp
+/// @author JF
+/// @date May 10, 2023
+#include "checkpoint.h"
+#include "eeprom_queue.h"
+#include "eeprom_ring.h"
+
+/// The checkpoint ring in the eeprom.
+static eeprom_ring_t checkpoint_ring = {EEPROM_ADDR_CHECKPOINT, EEPROM_CHECKPOINT_RECORD_SIZE, EEPROM_CHECKPOINT_RECORDS, 0u, 0u};
+
+/// The wakeups left until the next checkpoint.
+static uint16_t checkpoint_countdown = CHECKPOINT_INTERVAL_CYCLES;
+
+/// The wake state of the last checkpoint, a change triggers a checkpoint.
+static uint8_t checkpoint_wake_state;
+
+/// The newest checkpoint, queued for the next eeprom flush. Newer checkpoints replace it until then.
+static uint8_t checkpoint_record[EEPROM_CHECKPOINT_RECORD_SIZE - 1u];
+
+bool checkpoint_init(time_switch_state_t* state, uint8_t jumpers, bool resume) {
+    uint8_t record[EEPROM_CHECKPOINT_RECORD_SIZE - 1u];
+
+    eeprom_ring_init(&checkpoint_ring);
+    checkpoint_wake_state = state->wake_state;
+
+    if (!resume || !eeprom_ring_read_newest(&checkpoint_ring, record) ||
+        (record[0] & (CHECKPOINT_FLAG_12V | CHECKPOINT_FLAG_ALL_FEATURES)) != jumpers) {
+        return false;
+    }
+
+    time_switch_resume(state, (record[0] & CHECKPOINT_FLAG_LOAD_OFF) ? STATE_LOAD_OFF : STATE_LOAD_ON,
+                       ((uint16_t)record[1] << 8u) | record[2]);
+    checkpoint_wake_state = state->wake_state;
+    return true;
+}
+
+void checkpoint_wakeup(const time_switch_state_t* state, uint8_t jumpers) {
+    if (--checkpoint_countdown != 0u && state->wake_state == checkpoint_wake_state) {
+        return;
+    }
+
+    checkpoint_countdown = CHECKPOINT_INTERVAL_CYCLES;
+    checkpoint_wake_state = state->wake_state;
+
+    checkpoint_record[0] = jumpers | ((state->wake_state == STATE_LOAD_OFF) ? (uint8_t)CHECKPOINT_FLAG_LOAD_OFF : 0u);
+    checkpoint_record[1] = (uint8_t)(state->wakeup_count_load_feature >> 8u);
+    checkpoint_record[2] = (uint8_t)state->wakeup_count_load_feature;
+    eeprom_queue_ring(&checkpoint_ring, checkpoint_record);
+}
@@ -0,0 +1,71 @@
+/// @file eeprom_queue.cpp
+/// @author JF
+/// @date May 10, 2023
+#include <stddef.h>
+#include "eeprom_queue.h"
+#include "eeprom_writer.h"
+
+/// A pending write, either a ring record or a block at a fixed address.
+typedef struct eeprom_queue_entry {
+    const uint8_t* source;
+
+    /// NULL for a block write.
+    eeprom_ring_t* ring;
+    uint16_t address;
+    uint8_t length;
+} eeprom_queue_entry_t;
+
+static eeprom_queue_entry_t eeprom_queue[EEPROM_QUEUE_ENTRIES];
+static uint8_t eeprom_queue_count;
+
+/// Add a write to the queue, unless the same data is already queued.
+///
+/// @param entry The write.
+/// @return False if the queue is full.
+static bool eeprom_queue_add(const eeprom_queue_entry_t* entry) {
+    if (eeprom_queue_pending(entry->source)) {
+        return true;
+    }
+    if (eeprom_queue_count >= EEPROM_QUEUE_ENTRIES) {
+        return false;
+    }
+
+    eeprom_queue[eeprom_queue_count++] = *entry;
+    return true;
+}
+
+bool eeprom_queue_ring(eeprom_ring_t* ring, const uint8_t* payload) {
+    eeprom_queue_entry_t entry = {payload, ring, 0u, 0u};
+    return eeprom_queue_add(&entry);
+}
+
+bool eeprom_queue_block(uint16_t address, const uint8_t* source, uint8_t length) {
+    eeprom_queue_entry_t entry = {source, NULL, address, length};
+    return eeprom_queue_add(&entry);
+}
+
+bool eeprom_queue_pending(const uint8_t* source) {
+    for (uint8_t index = 0u; index < eeprom_queue_count; index++) {
+        if (eeprom_queue[index].source == source) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool eeprom_queue_empty(void) {
+    return eeprom_queue_count == 0u;
+}
+
+void eeprom_queue_flush(void) {
+    for (uint8_t index = 0u; index < eeprom_queue_count; index++) {
+        const eeprom_queue_entry_t* entry = &eeprom_queue[index];
+
+        if (entry->ring != NULL) {
+            eeprom_ring_append(entry->ring, entry->source);
+        } else {
+            eeprom_writer_write(entry->address, entry->source, entry->length);
+        }
+    }
+    eeprom_queue_count = 0u;
+}
@@ -0,0 +1,62 @@
+/// @file eeprom_ring.cpp
+/// @author JF
+/// @date May 10, 2023
+#include <avr/eeprom.h>
+#include "eeprom_layout.h"
+#include "eeprom_ring.h"
+#include "eeprom_writer.h"
+
+/// Get the eeprom address of a slot.
+///
+/// @param ring The ring.
+/// @param slot The slot index.
+/// @return The address of the sequence number of the slot.
+static uint8_t* slot_address(const eeprom_ring_t* ring, uint8_t slot) {
+    return (uint8_t*)(uintptr_t)(ring->address + (uint16_t)slot * ring->slot_size);
+}
+
+void eeprom_ring_init(eeprom_ring_t* ring) {
+    ring->next_slot = 0u;
+    ring->next_sequence = 0u;
+
+    for (uint8_t slot = 0u; slot < ring->slot_count; slot++) {
+        uint8_t sequence = eeprom_read_byte(slot_address(ring, slot));
+        if (sequence == EEPROM_RING_SEQUENCE_ERASED) {
+            continue;
+        }
+
+        // The newest record is followed by an erased slot or the oldest record.
+        uint8_t next_slot = (slot + 1u < ring->slot_count) ? (slot + 1u) : 0u;
+        uint8_t next_sequence = (sequence + 1u < EEPROM_RING_SEQUENCE_MODULO) ? (sequence + 1u) : 0u;
+        if (eeprom_read_byte(slot_address(ring, next_slot)) != next_sequence) {
+            ring->next_slot = next_slot;
+            ring->next_sequence = next_sequence;
+            return;
+        }
+    }
+}
+
+bool eeprom_ring_read_newest(const eeprom_ring_t* ring, uint8_t* payload) {
+    uint8_t slot = (ring->next_slot > 0u) ? (ring->next_slot - 1u) : (ring->slot_count - 1u);
+    const uint8_t* address = slot_address(ring, slot);
+
+    if (eeprom_read_byte(address) == EEPROM_RING_SEQUENCE_ERASED) {
+        return false;
+    }
+
+    eeprom_read_block(payload, address + 1u, ring->slot_size - 1u);
+    return true;
+}
+
+void eeprom_ring_append(eeprom_ring_t* ring, const uint8_t* payload) {
+    uint16_t address = ring->address + (uint16_t)ring->next_slot * ring->slot_size;
+    const uint8_t erased = EEPROM_RING_SEQUENCE_ERASED;
+
+    // Invalidate the slot first, then write the payload and commit it with the sequence number.
+    eeprom_writer_write(address, &erased, 1u);
+    eeprom_writer_write(address + 1u, payload, ring->slot_size - 1u);
+    eeprom_writer_write(address, &ring->next_sequence, 1u);
+
+    ring->next_slot = (ring->next_slot + 1u < ring->slot_count) ? (ring->next_slot + 1u) : 0u;
+    ring->next_sequence = (ring->next_sequence + 1u < EEPROM_RING_SEQUENCE_MODULO) ? (ring->next_sequence + 1u) : 0u;
+}
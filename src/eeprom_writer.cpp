@@ -0,0 +1,70 @@
+/// @file eeprom_writer.cpp
+/// @author JF
+/// @date May 10, 2023
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include "eeprom_writer.h"
+
+/// The write in progress, only accessed by the interrupt while EERIE is set.
+static const uint8_t* eeprom_writer_source;
+static uint16_t eeprom_writer_address;
+static uint8_t eeprom_writer_length;
+
+/// The eeprom is ready: start the next byte that differs from the eeprom content, or stop once all are written.
+ISR(EE_RDY_vect) {
+    while (eeprom_writer_length > 0u) {
+        uint8_t value = *eeprom_writer_source++;
+        uint8_t mode;
+
+        EEAR = eeprom_writer_address++;
+        eeprom_writer_length--;
+
+        EECR |= _BV(EERE);
+        uint8_t current = EEDR;
+        if (current == value) {
+            continue;
+        }
+
+        if ((current & value) == value) {
+            // Only bits to clear: write only.
+            mode = _BV(EEPM1);
+        } else if (value == 0xFFu) {
+            // Erase only.
+            mode = _BV(EEPM0);
+        } else {
+            // Atomic erase and write.
+            mode = 0u;
+        }
+
+        // EEPE has to be set within 4 cycles after EEMPE (pg. 21).
+        EEDR = value;
+        EECR = _BV(EERIE) | mode | _BV(EEMPE);
+        EECR |= _BV(EEPE);
+        return;
+    }
+
+    // Done, disable the interrupt. It would fire continuously while the eeprom is ready.
+    EECR = 0u;
+}
+
+void eeprom_writer_write(uint16_t address, const uint8_t* source, uint8_t length) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+    cli();
+    eeprom_writer_source = source;
+    eeprom_writer_address = address;
+    eeprom_writer_length = length;
+
+    // The interrupt fires as soon as interrupts are enabled again, the eeprom is idle here.
+    EECR = _BV(EERIE);
+    while (EECR & _BV(EERIE)) {
+        // No interrupt can be lost between sei and sleep_cpu, the instruction after sei is always executed first.
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    sei();
+}
@@ -0,0 +1,51 @@
+/// @file event_log.cpp
+/// @author JF
+/// @date May 10, 2023
+#include <stddef.h>
+#include "eeprom_queue.h"
+#include "eeprom_ring.h"
+#include "event_log.h"
+
+/// The event log ring in the eeprom.
+static eeprom_ring_t event_log_ring = {EEPROM_ADDR_EVENT_LOG, EEPROM_EVENT_LOG_RECORD_SIZE, EEPROM_EVENT_LOG_RECORDS, 0u, 0u};
+
+/// The events waiting in the eeprom queue, stored in the record format without sequence number.
+/// Used round robin, if more events occur before a flush the oldest one is replaced.
+static uint8_t event_log_pending[EVENT_LOG_PENDING_MAX][EEPROM_EVENT_LOG_RECORD_SIZE - 1u];
+static uint8_t event_log_pending_next;
+
+/// False if the event log is disabled in the configuration.
+static bool event_log_enabled;
+
+void event_log_init(bool enabled) {
+    event_log_enabled = enabled;
+    if (enabled) {
+        eeprom_ring_init(&event_log_ring);
+    }
+}
+
+void event_log_add(uint8_t type, uint16_t data) {
+    uint8_t* record = NULL;
+
+    if (!event_log_enabled) {
+        return;
+    }
+
+    // Only the latest load cycle count is of interest.
+    for (uint8_t pending = 0u; pending < EVENT_LOG_PENDING_MAX; pending++) {
+        if (type == EVENT_LOG_LOAD_CYCLES && event_log_pending[pending][0] == EVENT_LOG_LOAD_CYCLES &&
+            eeprom_queue_pending(event_log_pending[pending])) {
+            record = event_log_pending[pending];
+        }
+    }
+
+    if (record == NULL) {
+        record = event_log_pending[event_log_pending_next];
+        event_log_pending_next = (event_log_pending_next + 1u < EVENT_LOG_PENDING_MAX) ? (event_log_pending_next + 1u) : 0u;
+    }
+
+    record[0] = type;
+    record[1] = (uint8_t)(data >> 8u);
+    record[2] = (uint8_t)data;
+    eeprom_queue_ring(&event_log_ring, record);
+}
@@ -0,0 +1,71 @@
+/// @file lifetime_stats.cpp
+/// @author JF
+/// @date May 10, 2023
+#include "eeprom_queue.h"
+#include "eeprom_ring.h"
+#include "lifetime_stats.h"
+
+// Unpadded on the avr: 15 bytes. The record payload is always read and written with this size.
+static_assert(sizeof(lifetime_stats_t) >= EEPROM_LIFETIME_STATS_RECORD_SIZE - 1u, "Lifetime statistics record size.");
+
+/// The lifetime statistics ring in the eeprom.
+static eeprom_ring_t lifetime_stats_ring = {EEPROM_ADDR_LIFETIME_STATS, EEPROM_LIFETIME_STATS_RECORD_SIZE,
+                                            EEPROM_LIFETIME_STATS_RECORDS, 0u, 0u};
+
+/// The statistics, also the payload queued for the eeprom.
+static lifetime_stats_t lifetime_stats;
+
+/// The wakeups left until the next record.
+static uint16_t lifetime_stats_countdown = LIFETIME_STATS_INTERVAL_CYCLES;
+
+/// Queue the statistics for the next eeprom flush.
+static void queue_lifetime_stats(void) {
+    lifetime_stats_countdown = LIFETIME_STATS_INTERVAL_CYCLES;
+    eeprom_queue_ring(&lifetime_stats_ring, (const uint8_t*)&lifetime_stats);
+}
+
+void lifetime_stats_init(void) {
+    eeprom_ring_init(&lifetime_stats_ring);
+
+    if (!eeprom_ring_read_newest(&lifetime_stats_ring, (uint8_t*)&lifetime_stats)) {
+        lifetime_stats.battery_voltage_min = UINT16_MAX;
+        lifetime_stats.battery_voltage_max = 0u;
+        lifetime_stats.load_on_wakeups = 0u;
+        lifetime_stats.measurement_count = 0u;
+        lifetime_stats.undervoltage_trip_count = 0u;
+        lifetime_stats.reset_count = 0u;
+    }
+
+    if (lifetime_stats.reset_count != UINT8_MAX) {
+        lifetime_stats.reset_count++;
+    }
+}
+
+void lifetime_stats_measurement(uint16_t battery_voltage, bool undervoltage_trip) {
+    lifetime_stats.measurement_count++;
+
+    if (battery_voltage < lifetime_stats.battery_voltage_min) {
+        lifetime_stats.battery_voltage_min = battery_voltage;
+    }
+    if (battery_voltage > lifetime_stats.battery_voltage_max) {
+        lifetime_stats.battery_voltage_max = battery_voltage;
+    }
+
+    // Queue every trip without waiting for the daily record. The write itself is deferred like all eeprom writes:
+    // eeprom_queue_flush() only runs after a measurement above the threshold plus EEPROM_QUEUE_FLUSH_MARGIN_ADC, so the
+    // trip reaches the eeprom once the battery has recovered, not while it is sagging.
+    if (undervoltage_trip) {
+        lifetime_stats.undervoltage_trip_count++;
+        queue_lifetime_stats();
+    }
+}
+
+void lifetime_stats_wakeup(bool load_enabled) {
+    if (load_enabled) {
+        lifetime_stats.load_on_wakeups++;
+    }
+
+    if (--lifetime_stats_countdown == 0u) {
+        queue_lifetime_stats();
+    }
+}
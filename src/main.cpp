@@ -20,7 +20,15 @@
 #include <avr/sleep.h>
 #include <avr/power.h>
 #include <avr/wdt.h>
-#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include "checkpoint.h"
+#include "eeprom_config.h"
+#include "eeprom_layout.h"
+#include "eeprom_queue.h"
+#include "event_log.h"
+#include "lifetime_stats.h"
+#include "stack_watermark.h"
+#include "time_switch.h"
 
 /// Define relevant pins.
 #define VBAT_EN_PIN PB0
@@ -32,61 +40,46 @@
 /// If defined, don't go to sleep but ensure the clock output can be measured on pin PB4 (feature select middle pin).
 // #define CLOCK_CALIBRATION_MODE
 
-/// 15min: Battery measurement period. The amount of wakeup cycles corresponding to 15min (8.192s per cycle). 15*60/8.192.
-#define TIMING_CYCLES_BATTERY_MEASUREMENT 110u
+/// If defined, the free ram is painted with @ref STACK_CANARY at startup and the stack high-water mark is checked after
+/// every battery measurement and the eeprom flush following it. The deepest path is the EE_RDY ISR nested in the idle
+/// sleep of the eeprom writer. The smallest headroom ever seen is queued big-endian for @ref EEPROM_ADDR_STACK_HEADROOM_MSB
+/// and written with the next flush. Build with `pio run -e attiny85_stack_watermark`, read it back with eeprom_decode.
+// #define STACK_WATERMARK_MODE
 
-/// The 10V equivalent raw adc value under which to disable the load for a 12V device (0-1023u).
-/// R1: 100k, R2: 22k
-/// (Vbat)*(22/122)*(1/2.56V)*1023
-/// (10V)*(22/122)*(1/2.56V)*1023
-#define ADC_BATTERY_THRESHOLD_12v 721u
+#ifdef STACK_WATERMARK_MODE
+/// End of the static variables and top of the ram, provided by the linker.
+extern uint8_t _end;
+extern uint8_t __stack;
 
-/// The 20V equivalent raw adc value under which to disable the load for a 24V device ( 0-1023, (Vbat)*(10/110)*(1/2.56V)*1023).
-/// R1: 100k, R2: 10k
-/// (Vbat)*(10/110)*(1/2.56V)*1023 )
-/// (20V)*(10/110)*(1/2.56V)*1023
-#define ADC_BATTERY_THRESHOLD_24v 726u
+/// The smallest stack headroom seen so far.
+static uint16_t stack_headroom_min = UINT16_MAX;
 
-/// 16h on: 12V. The amount of wakeup cycles corresponding to 8h/28800s for a 12V device (8.192s per cycle). 16*3600/8.192.
-#define TIMING_CYCLES_LOAD_ON_12V 7031u
-/// 8h off: 12V. The amount of wakeup cycles corresponding to 16h/57600s for a 12V device (8.192s per cycle). 8*3600/8.192.
-#define TIMING_CYCLES_LOAD_OFF_12V 3516u
-
-/// 20h on: 24V. The amount of wakeup cycles corresponding to 8h/28800s for a 24V device (8.192s per cycle). 20*3600/8.192.
-#define TIMING_CYCLES_LOAD_ON_24V 8789u
-/// 4h off: 24V. The amount of wakeup cycles corresponding to 16h/57600s for a 24V device (8.192s per cycle). 4*3600/8.192.
-#define TIMING_CYCLES_LOAD_OFF_24V 1758u
-
-/// Possibility to store calibration values in eeprom memory.
-enum eeprom_addresses {
-    EEPROM_ADDR_CLOCK_CALIB_3_MSB = 0x0u,
-    EEPROM_ADDR_CLOCK_CALIB_2,
-    EEPROM_ADDR_CLOCK_CALIB_1,
-    EEPROM_ADDR_CLOCK_CALIB_0_LSB,
-    EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER
-};
+/// @ref stack_headroom_min big-endian, queued for the eeprom.
+static uint8_t stack_headroom_record[2];
+#endif
 
-// The magic number that must be present in the eeprom to apply the clock calibration algorithm.
-#define EEPROM_CLOCK_CALIB_MAGIC_NUMBER 0xCDu
+/// The jumper and calibration dependent configuration, fixed after startup.
+/// With a two point clock calibration, the calibrated timing follows the temperature.
+static time_switch_config_t time_switch_config;
 
-/// The value of the 128kHz clock used to clock the sleep watchdog timer.
-#define SLEEP_CLOCK_VALUE_HZ 128000lu
+/// The two point clock calibration, only used if @ref clock_calibration_two_point is set.
+static clock_calibration_points_t clock_calibration_points;
+static bool clock_calibration_two_point;
 
-/// The maximum deviation from @ref SLEEP_CLOCK_VALUE_HZ above or below which to discard clock calibration values.
-#define SLEEP_CLOCK_DEVIATION_MAX_HZ 30000lu
+/// The wakeups since the last temperature measurement of the two point clock calibration.
+static uint16_t wakeup_count_temperature;
 
-/// The clock calibration gets read from eeprom at startup.
-static uint32_t clock_calibration;
+/// The state of the load switching logic.
+static time_switch_state_t time_switch_state;
 
-/// All features active or only the undervoltage protection is active. Selectable by a jumper.
-static bool all_features_activated;
+/// The jumper settings as stored in the schedule checkpoint.
+static uint8_t checkpoint_jumpers;
 
-/// The timing for the load on/off feature with the selectable 12/24V jumper.
-static uint16_t timing_cycles_load_on;
-static uint16_t timing_cycles_load_off;
+/// The amount of times the time switch enabled the load since the last reset.
+static uint16_t load_cycle_count;
 
-/// The raw adc threshold under which to disable the load.
-static uint16_t undervoltage_adc_threshold;
+/// The wakeups since the last battery measurement, counted while eeprom writes are pending.
+static uint16_t wakeup_count_eeprom_queue;
 
 /// Turn on the watchdog to wake the system from sleep.
 /// The timeout value is 1048576 cycles @128kHz (8.192s).
@@ -114,11 +107,6 @@ static void enable_voltage_divider(bool enable);
 /// @param enable True to enable the load, false to disable it.
 static void enable_load(bool enable);
 
-/// Check if the load is currently activatedd.
-///
-/// @return True if the load is activated.
-static bool is_load_enabled(void);
-
 /// Get the currently selected 12V/24V timing mode.
 ///
 /// @return True: 12V timing, false: 24V timing.
@@ -129,33 +117,39 @@ static bool get_12V_24V_selection(void);
 /// @return True: all features, false: only undervoltage protection.
 static bool get_feature_selection(void);
 
-/// Check if the feature to enable/disable the load in regular intervals is currently active.
-///
-/// @return True if the load timing is active.
-static bool load_timing_activated(void);
-
 /// Read the current battery voltage.
 ///
 /// @return The battery voltage as a 10 bit value.
 static uint16_t read_battery_voltage(void);
 
-/// Read the pre-programmed clock calibration value.
+/// Read the internal temperature sensor (~1 LSB per degree Celsius) against the 1.1V reference.
 ///
-/// @return The clock calibration value.
-static uint32_t read_clock_calibration(void);
+/// @return The raw 10 bit sensor value.
+static uint16_t read_temperature_sensor(void);
 
-/// Apply the clock calibration calculation to obtain a more precise sleep timing behaviour.
+/// Interpolate the clock calibration at the current temperature and apply it to the timing.
+static void update_clock_calibration(void);
+
+/// Read the configuration block from the eeprom in one burst.
+/// If it is missing or corrupted, fall back to the compiled defaults and the legacy clock calibration:
+/// the clock calibration is only applied if @ref EEPROM_CLOCK_CALIB_MAGIC_NUMBER is present in the eeprom.
 ///
-/// @param clock_calibration The clock calibration read from the eeprom.
-/// @param uncalibrated_value The uncalibrated value.
-/// @return The calibrated value.
-static uint32_t apply_clock_calibration(uint32_t clock_calibration, uint32_t uncalibrated_value);
+/// @param config The configuration to fill in.
+static void read_config(eeprom_config_t* config);
+
+#ifdef STACK_WATERMARK_MODE
+/// Paint the ram between the static variables and the top of the stack with @ref STACK_CANARY.
+/// Runs from the .init1 section, before the stack pointer is set up, hence no C code.
+void paint_stack(void) __attribute__((naked, used, section(".init1")));
 
-/// Checks whether the @ref EEPROM_CLOCK_CALIB_MAGIC_NUMBER is present in the eeprom.
-/// If yes, the clock calibration algorithm will be run.
+/// Count the painted bytes the stack has never touched.
 ///
-/// @return True if the clock calibration values are present.
-static bool clock_calibration_present(void);
+/// @return The stack headroom in bytes.
+static uint16_t read_stack_headroom(void);
+
+/// Update @ref stack_headroom_min and store it in the eeprom if it decreased.
+static void check_stack_headroom(void);
+#endif
 
 static void enable_voltage_divider(bool enable) {
     digitalWrite(VDIV_EN_PIN, enable ? LOW : HIGH);
@@ -165,10 +159,6 @@ static void enable_load(bool enable) {
     digitalWrite(VBAT_EN_PIN, enable ? HIGH : LOW);
 }
 
-static bool is_load_enabled(void) {
-    return digitalRead(VBAT_EN_PIN) == HIGH;
-}
-
 static bool get_12V_24V_selection(void) {
     return digitalRead(SELECT_12_24V_PIN) == HIGH;
 }
@@ -177,10 +167,6 @@ static bool get_feature_selection(void) {
     return digitalRead(SELECT_FEATURE_PIN) == LOW;
 }
 
-static bool load_timing_activated(void) {
-    return all_features_activated == true;
-}
-
 static void enable_adc(bool enable) {
     if (enable) {
         bitSet(ADCSRA, ADEN);
@@ -199,6 +185,10 @@ static uint16_t read_battery_voltage(void) {
     // Enable the adc.
     enable_adc(true);
 
+    // Select the 2.56V reference and the battery input right away, so the reference settles during the wait below.
+    // A temperature measurement leaves the 1.1V reference selected. The conversion itself is discarded.
+    (void)analogRead(ADC_BATTERY_PIN);
+
     // Quickly pulse the gate of the p-fet of the voltage divider to enable it.
     // Now the voltage divider is active for 230ms.
     enable_voltage_divider(true);
@@ -224,6 +214,68 @@ static uint16_t read_battery_voltage(void) {
     return battery_voltage;
 }
 
+static uint16_t read_temperature_sensor(void) {
+    // The amount of averages to take from the adc reading. Must be a power of two.
+#define TEMPERATURE_AVERAGE_NUM 8u
+#define TEMPERATURE_DIVISION_SHIFT 3u // 2^TEMPERATURE_DIVISION_SHIFT = TEMPERATURE_AVERAGE_NUM
+    uint16_t temperature = 0u;
+
+    enable_adc(true);
+
+    // Internal 1.1V reference, temperature sensor on ADC4 (pg. 134). The next battery measurement selects its
+    // reference again before it lets the voltages settle.
+    ADMUX = bit(REFS1) | bit(MUX3) | bit(MUX2) | bit(MUX1) | bit(MUX0);
+
+    // Let the reference settle, the first conversion after switching the reference is discarded.
+    delay(1);
+    for (uint8_t adc_reading = 0u; adc_reading <= TEMPERATURE_AVERAGE_NUM; adc_reading++) {
+        bitSet(ADCSRA, ADSC);
+        while (bit_is_set(ADCSRA, ADSC)) {
+        }
+        if (adc_reading > 0u) {
+            temperature += ADC;
+        }
+    }
+
+    enable_adc(false);
+
+    return temperature >> TEMPERATURE_DIVISION_SHIFT;
+}
+
+static void update_clock_calibration(void) {
+    uint32_t clock_calibration = interpolate_clock_calibration(&clock_calibration_points, read_temperature_sensor());
+    time_switch_calibrate(&time_switch_config, clock_calibration);
+}
+
+#ifdef STACK_WATERMARK_MODE
+void paint_stack(void) {
+    __asm volatile("    ldi r30, lo8(_end)\n"
+                   "    ldi r31, hi8(_end)\n"
+                   "    ldi r24, %0\n"
+                   "    ldi r25, hi8(__stack)\n"
+                   "    rjmp 2f\n"
+                   "1:  st Z+, r24\n"
+                   "2:  cpi r30, lo8(__stack)\n"
+                   "    cpc r31, r25\n"
+                   "    brlo 1b\n"
+                   "    breq 1b\n" ::"M"(STACK_CANARY));
+}
+
+static uint16_t read_stack_headroom(void) {
+    return stack_watermark_headroom(&_end, &__stack);
+}
+
+static void check_stack_headroom(void) {
+    uint16_t headroom = read_stack_headroom();
+
+    if (stack_watermark_update(&stack_headroom_min, headroom)) {
+        stack_headroom_record[0] = (uint8_t)(headroom >> 8u);
+        stack_headroom_record[1] = (uint8_t)headroom;
+        eeprom_queue_block(EEPROM_ADDR_STACK_HEADROOM_MSB, stack_headroom_record, sizeof(stack_headroom_record));
+    }
+}
+#endif
+
 ISR(WDT_vect) {
     wdt_disable();
 }
@@ -279,70 +331,62 @@ static void initialize_gpios(void) {
     pinMode(SELECT_FEATURE_PIN, INPUT);
 }
 
-static uint32_t read_clock_calibration(void) {
-    uint32_t clock_calib;
-    clock_calib = ((uint32_t)EEPROM.read(EEPROM_ADDR_CLOCK_CALIB_3_MSB) << 24u) |
-                  ((uint32_t)EEPROM.read(EEPROM_ADDR_CLOCK_CALIB_2) << 16u) |
-                  ((uint32_t)EEPROM.read(EEPROM_ADDR_CLOCK_CALIB_1) << 8u) |
-                  (uint32_t)EEPROM.read(EEPROM_ADDR_CLOCK_CALIB_0_LSB);
-    return (clock_calib == 0xFFFFFFFFlu) ? 0u : clock_calib;
-}
+static void read_config(eeprom_config_t* config) {
+    uint8_t legacy_calibration[EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER + 1u];
 
-static uint32_t apply_clock_calibration(uint32_t clock_calibration, uint32_t uncalibrated_value) {
-    // Discard too high or too low calibration values.
-    if ((clock_calibration < (SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ)) ||
-        clock_calibration > (SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ)) {
-        return uncalibrated_value;
+    eeprom_read_block(config, (const void*)EEPROM_ADDR_CONFIG, sizeof(eeprom_config_t));
+    if (eeprom_config_valid(config)) {
+        eeprom_config_upgrade(config);
+    } else {
+        eeprom_config_defaults(config);
     }
 
-    return (clock_calibration * uncalibrated_value) / SLEEP_CLOCK_VALUE_HZ;
-}
-
-static bool clock_calibration_present(void) {
-    return (EEPROM.read(EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER) == EEPROM_CLOCK_CALIB_MAGIC_NUMBER);
+    // A block without clock calibration keeps the calibration measured for this chip.
+    eeprom_read_block(legacy_calibration, (const void*)EEPROM_ADDR_CLOCK_CALIB_3_MSB, sizeof(legacy_calibration));
+    eeprom_config_legacy_calibration(config, legacy_calibration);
 }
 
 void setup() {
+    // Keep the reset cause, the watchdog setup clears MCUSR before every sleep.
+    uint8_t reset_flags = MCUSR;
+
     // Set all gpios to their default level.
     initialize_gpios();
 
     // Only enable the adc if a battery voltage measurement is ongoing.
     enable_adc(false);
 
-    // Read in the pre-programmed clock calibration value.
-    clock_calibration = read_clock_calibration();
-
-    // Read the feature selection jumper.
-    all_features_activated = get_feature_selection();
-
-    // Read the 12/24V selection jumper.
+    // Derive the timing from the jumpers and the pre-programmed configuration.
+    eeprom_config_t config;
+    read_config(&config);
+    bool all_features_activated = get_feature_selection();
     bool _12_24V_selection = get_12V_24V_selection();
+    time_switch_configure(&time_switch_config, &config.parameters, all_features_activated, _12_24V_selection,
+                          (config.flags & EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION) != 0u, config.clock_calibration);
+
+    // A two point clock calibration replaces the single point one, starting at the current temperature.
+    clock_calibration_two_point = (config.flags & EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION) != 0u;
+    if (clock_calibration_two_point) {
+        eeprom_config_calibration_points(&config, &clock_calibration_points);
+        update_clock_calibration();
+    }
 
-    // Apply the correct timing.
-    timing_cycles_load_on = (_12_24V_selection == true) ? TIMING_CYCLES_LOAD_ON_12V : TIMING_CYCLES_LOAD_ON_24V;
-    timing_cycles_load_off = (_12_24V_selection == true) ? TIMING_CYCLES_LOAD_OFF_12V : TIMING_CYCLES_LOAD_OFF_24V;
-    undervoltage_adc_threshold = (_12_24V_selection == true) ? ADC_BATTERY_THRESHOLD_12v : ADC_BATTERY_THRESHOLD_24v;
-
-    // Check whether to apply a clock calibration, if yes adjust the timing values accordingly.
-    if (clock_calibration_present()) {
-        timing_cycles_load_on = apply_clock_calibration(clock_calibration, timing_cycles_load_on);
-        timing_cycles_load_off = apply_clock_calibration(clock_calibration, timing_cycles_load_off);
+    // Start with the load on, or continue the schedule where it was before the reset.
+    // A reset by the reset pin (e.g. after changing the jumpers) restarts the schedule.
+    time_switch_init(&time_switch_state);
+    if (all_features_activated) {
+        checkpoint_jumpers = CHECKPOINT_FLAG_ALL_FEATURES | (_12_24V_selection ? (uint8_t)CHECKPOINT_FLAG_12V : 0u);
+        checkpoint_init(&time_switch_state, checkpoint_jumpers, (reset_flags & bit(EXTRF)) == 0u);
     }
+    enable_load(time_switch_state.load_enabled);
 
-    // Start with the load on.
-    enable_load(true);
+    // Log the reset cause with the next batch of events.
+    event_log_init((config.flags & EEPROM_CONFIG_FLAG_EVENT_LOG) != 0u);
+    event_log_add(EVENT_LOG_RESET, reset_flags);
+    lifetime_stats_init();
 }
 
 void loop() {
-    static uint16_t wakeup_count_load_feature = 0u;
-    static uint16_t wakeup_count_undervoltage_protection = 0u;
-    static bool undervoltage_protection_triggered = false;
-    typedef enum wake_states {
-        STATE_LOAD_ON,
-        STATE_LOAD_OFF,
-    } wake_states_t;
-    static wake_states_t wake_state = STATE_LOAD_ON;
-
     // Loop forever if clock calibration mode is selected.
 #ifdef CLOCK_CALIBRATION_MODE
     while (true) {
@@ -350,46 +394,63 @@ void loop() {
 #endif
 
     go_to_sleep();
-    wakeup_count_load_feature++;
-    wakeup_count_undervoltage_protection++;
+
+    bool load_enabled = time_switch_state.load_enabled;
 
     // Periodically measure the battery voltage if the load is active.
-    if (is_load_enabled() && (wakeup_count_undervoltage_protection >= TIMING_CYCLES_BATTERY_MEASUREMENT)) {
-        wakeup_count_undervoltage_protection = 0u;
+    // Without load (switched off or after an undervoltage trip), only measure if eeprom writes are pending.
+    bool measurement_due = time_switch_wakeup(&time_switch_state);
+    bool flush_due = !eeprom_queue_empty() && (++wakeup_count_eeprom_queue >= TIMING_CYCLES_BATTERY_MEASUREMENT);
 
-        // Disable the load if the battery voltage falls under the predefined threshold.
-        if (read_battery_voltage() < undervoltage_adc_threshold) {
-            enable_load(false);
-            undervoltage_protection_triggered = true;
-        }
-    }
+    if (measurement_due || flush_due) {
+        uint16_t battery_voltage = read_battery_voltage();
+        wakeup_count_eeprom_queue = 0u;
 
-    // If the feature selection jumper is set to all features, enable/disable the load regularly.
-    // If the battery voltage has once fallen under the threshold, never activate the load again.
-    if (load_timing_activated() && !undervoltage_protection_triggered) {
-        switch (wake_state) {
-        case STATE_LOAD_ON: {
-            if (wakeup_count_load_feature >= timing_cycles_load_on) {
-                wakeup_count_load_feature = 0u;
-                enable_load(false);
-                wake_state = STATE_LOAD_OFF;
-            }
-            break;
-        }
+        if (measurement_due) {
+            time_switch_battery_measured(&time_switch_state, &time_switch_config, battery_voltage);
 
-        case STATE_LOAD_OFF: {
-            if (wakeup_count_load_feature >= timing_cycles_load_off) {
-                wakeup_count_load_feature = 0u;
-                enable_load(true);
-                wake_state = STATE_LOAD_ON;
+            if (time_switch_state.undervoltage_protection_triggered) {
+                event_log_add(EVENT_LOG_UNDERVOLTAGE_TRIP, battery_voltage);
             }
-            break;
         }
+        lifetime_stats_measurement(battery_voltage, measurement_due && time_switch_state.undervoltage_protection_triggered);
 
-        default: {
-            wake_state = STATE_LOAD_OFF;
-            break;
+        // Only write the eeprom while the supply is safely above the undervoltage threshold.
+        if (battery_voltage >= time_switch_config.undervoltage_adc_threshold + EEPROM_QUEUE_FLUSH_MARGIN_ADC) {
+            eeprom_queue_flush();
         }
+
+#ifdef STACK_WATERMARK_MODE
+        // After the flush, its nested EE_RDY ISR is the deepest stack use.
+        check_stack_headroom();
+#endif
+    }
+
+    // Follow the temperature drift of the sleep clock.
+    if (clock_calibration_two_point && (++wakeup_count_temperature >= TIMING_CYCLES_BATTERY_MEASUREMENT)) {
+        wakeup_count_temperature = 0u;
+        update_clock_calibration();
+    }
+
+    // Enable/disable the load regularly if all features are selected.
+    time_switch_update_load_timing(&time_switch_state, &time_switch_config);
+
+    // Persist the schedule phase as long as the schedule is running.
+    if (time_switch_config.all_features_activated && !time_switch_state.undervoltage_protection_triggered) {
+        checkpoint_wakeup(&time_switch_state, checkpoint_jumpers);
+    }
+
+    lifetime_stats_wakeup(time_switch_state.load_enabled);
+
+    if (time_switch_state.load_enabled != load_enabled) {
+        enable_load(time_switch_state.load_enabled);
+
+        // Log the load cycles in batches to keep the eeprom writes rare.
+        if (time_switch_state.load_enabled) {
+            load_cycle_count++;
+            if ((load_cycle_count % EVENT_LOG_LOAD_CYCLES_BATCH) == 0u) {
+                event_log_add(EVENT_LOG_LOAD_CYCLES, load_cycle_count);
+            }
         }
     }
 }
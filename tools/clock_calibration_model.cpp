@@ -0,0 +1,221 @@
+/// @file clock_calibration_model.cpp
+/// Host tool: compare the timing accuracy of the single point and the two point clock calibration.
+///
+/// The sleep clock is modelled with a temperature coefficient around its frequency at 25degC, the temperature
+/// follows a daily sine. Every wakeup of the firmware is simulated with the code from `time_switch.h`, once with the
+/// single point calibration measured at 25degC and once with the two point calibration measured at two temperatures,
+/// interpolated every @ref TIMING_CYCLES_BATTERY_MEASUREMENT wakeups from the modelled temperature sensor reading
+/// like the firmware does. The durations of all load on/off phases are compared with the configured hours.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o clock_calibration_model tools/clock_calibration_model.cpp
+/// Usage: clock_calibration_model [--24v] [--clock HZ] [--tempco PPM] [--curvature PPM] [--mean C] [--swing C]
+///                                [--points C1,C2] [--sensor-offset LSB] [--days N]
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eeprom_image.h"
+
+/// The model and simulation settings.
+typedef struct model_options {
+    bool _12_24V_selection;
+
+    /// Sleep clock frequency at 25degC in Hz.
+    double clock_hz;
+
+    /// Linear (ppm/degC) and quadratic (ppm/degC^2) temperature coefficients of the sleep clock.
+    double tempco_ppm;
+    double curvature_ppm;
+
+    /// Daily temperature: mean and amplitude in degC.
+    double mean_celsius;
+    double swing_celsius;
+
+    /// Temperatures of the two calibration points in degC.
+    double point_celsius[2];
+
+    /// Offset of the temperature sensor of the modelled chip in LSB.
+    double sensor_offset;
+    unsigned days;
+} model_options_t;
+
+/// The timing error of one calibration method.
+typedef struct phase_errors {
+    unsigned long phases;
+    double sum_error_s;
+    double max_error_s;
+} phase_errors_t;
+
+/// Get the modelled sleep clock frequency.
+///
+/// @param options The model.
+/// @param celsius The temperature in degC.
+/// @return The frequency in Hz.
+static double sleep_clock_hz(const model_options_t* options, double celsius) {
+    double delta = celsius - 25.0;
+    return options->clock_hz * (1.0 + (options->tempco_ppm * delta + options->curvature_ppm * delta * delta) * 1e-6);
+}
+
+/// Get the modelled temperature sensor reading as seen by the firmware (averaged and truncated).
+///
+/// @param options The model.
+/// @param celsius The temperature in degC.
+/// @return The raw 10 bit sensor value.
+static uint16_t sensor_reading(const model_options_t* options, double celsius) {
+    return eeprom_image_temperature_to_sensor(celsius + options->sensor_offset * (65.0 / 70.0));
+}
+
+/// Get the modelled temperature.
+///
+/// @param options The model.
+/// @param time_s The time since the start in seconds, the coldest point is at 0s.
+/// @return The temperature in degC.
+static double temperature(const model_options_t* options, double time_s) {
+    return options->mean_celsius - options->swing_celsius * cos(2.0 * M_PI * time_s / 86400.0);
+}
+
+/// Simulate all wakeups and collect the errors of the load on/off phases.
+///
+/// @param options The model.
+/// @param points The two point calibration, NULL for the single point calibration at 25degC.
+/// @param errors The errors of the on and the off phases.
+static void simulate(const model_options_t* options, const clock_calibration_points_t* points, phase_errors_t errors[2]) {
+    time_switch_parameters_t parameters;
+    time_switch_config_t config;
+    time_switch_state_t state;
+    uint16_t wakeup_count_temperature = 0u;
+    double time_s = 0.0;
+    double phase_start_s = 0.0;
+
+    time_switch_default_parameters(&parameters);
+    time_switch_configure(&config, &parameters, true, options->_12_24V_selection, true,
+                          (uint32_t)lround(sleep_clock_hz(options, 25.0)));
+    if (points != NULL) {
+        time_switch_calibrate(&config, interpolate_clock_calibration(points, sensor_reading(options, 0.0)));
+    }
+    time_switch_init(&state);
+    memset(errors, 0, 2u * sizeof(phase_errors_t));
+
+    const double nominal_s[2] = {config.timing_cycles_load_on_nominal * (double)SLEEP_CLOCK_CYCLES_PER_WAKEUP / SLEEP_CLOCK_VALUE_HZ,
+                                 config.timing_cycles_load_off_nominal * (double)SLEEP_CLOCK_CYCLES_PER_WAKEUP / SLEEP_CLOCK_VALUE_HZ};
+
+    while (time_s < options->days * 86400.0) {
+        bool load_enabled = state.load_enabled;
+
+        time_s += SLEEP_CLOCK_CYCLES_PER_WAKEUP / sleep_clock_hz(options, temperature(options, time_s));
+        if (time_switch_wakeup(&state)) {
+            time_switch_battery_measured(&state, &config, 1023u);
+        }
+
+        if (points != NULL && ++wakeup_count_temperature >= TIMING_CYCLES_BATTERY_MEASUREMENT) {
+            wakeup_count_temperature = 0u;
+            time_switch_calibrate(&config, interpolate_clock_calibration(points, sensor_reading(options, temperature(options, time_s))));
+        }
+
+        time_switch_update_load_timing(&state, &config);
+        if (state.load_enabled != load_enabled) {
+            // The phase that just ended: 0 on, 1 off.
+            phase_errors_t* phase = &errors[load_enabled ? 0u : 1u];
+            double error_s = (time_s - phase_start_s) - nominal_s[load_enabled ? 0u : 1u];
+
+            phase->phases++;
+            phase->sum_error_s += error_s;
+            phase->max_error_s = (fabs(error_s) > fabs(phase->max_error_s)) ? error_s : phase->max_error_s;
+            phase_start_s = time_s;
+        }
+    }
+}
+
+/// Print the errors of one calibration method.
+///
+/// @param name The calibration method.
+/// @param errors The errors of the on and the off phases.
+static void print_errors(const char* name, const phase_errors_t errors[2]) {
+    for (uint8_t phase = 0u; phase < 2u; phase++) {
+        double mean_s = (errors[phase].phases > 0u) ? (errors[phase].sum_error_s / errors[phase].phases) : 0.0;
+        printf("%-13s load %-3s %4lu phases, mean error %+7.1f min, worst %+7.1f min\n", name, (phase == 0u) ? "on" : "off",
+               errors[phase].phases, mean_s / 60.0, errors[phase].max_error_s / 60.0);
+    }
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: clock_calibration_model [options]\n"
+            "  --24v               24V timing (default 12V)\n"
+            "  --clock HZ          Sleep clock frequency at 25degC (default 110481)\n"
+            "  --tempco PPM        Linear temperature coefficient in ppm/degC (default -500)\n"
+            "  --curvature PPM     Quadratic temperature coefficient in ppm/degC^2 (default 0)\n"
+            "  --mean C            Mean temperature (default 15)\n"
+            "  --swing C           Daily temperature amplitude (default 15)\n"
+            "  --points C1,C2      Temperatures of the two point calibration (default 0,40)\n"
+            "  --sensor-offset LSB Offset of the temperature sensor (default 0)\n"
+            "  --days N            Simulated days (default 30)\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    model_options_t options = {true, 110481.0, -500.0, 0.0, 15.0, 15.0, {0.0, 40.0}, 0.0, 30u};
+    clock_calibration_points_t points;
+    phase_errors_t single_point[2];
+    phase_errors_t two_point[2];
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+
+        if (strcmp(option, "--24v") == 0) {
+            options._12_24V_selection = false;
+            continue;
+        }
+        if ((arg + 1) >= argc) {
+            print_usage();
+        }
+
+        const char* argument = argv[++arg];
+        if (strcmp(option, "--clock") == 0) {
+            options.clock_hz = atof(argument);
+        } else if (strcmp(option, "--tempco") == 0) {
+            options.tempco_ppm = atof(argument);
+        } else if (strcmp(option, "--curvature") == 0) {
+            options.curvature_ppm = atof(argument);
+        } else if (strcmp(option, "--mean") == 0) {
+            options.mean_celsius = atof(argument);
+        } else if (strcmp(option, "--swing") == 0) {
+            options.swing_celsius = atof(argument);
+        } else if (strcmp(option, "--points") == 0) {
+            if (sscanf(argument, "%lf,%lf", &options.point_celsius[0], &options.point_celsius[1]) != 2 ||
+                options.point_celsius[0] >= options.point_celsius[1]) {
+                print_usage();
+            }
+        } else if (strcmp(option, "--sensor-offset") == 0) {
+            options.sensor_offset = atof(argument);
+        } else if (strcmp(option, "--days") == 0) {
+            options.days = (unsigned)atoi(argument);
+        } else {
+            print_usage();
+        }
+    }
+
+    // The calibration points as measured on the chip: its own sensor reading and the rounded frequency.
+    points.sensor_low = sensor_reading(&options, options.point_celsius[0]);
+    points.sensor_high = sensor_reading(&options, options.point_celsius[1]);
+    points.clock_calibration_low = (uint32_t)lround(sleep_clock_hz(&options, options.point_celsius[0]));
+    points.clock_calibration_high = (uint32_t)lround(sleep_clock_hz(&options, options.point_celsius[1]));
+    if (!clock_calibration_points_valid(&points) || !eeprom_image_calibration_valid((uint32_t)lround(options.clock_hz))) {
+        fprintf(stderr, "The modelled sleep clock leaves the accepted calibration range.\n");
+        return 1;
+    }
+
+    simulate(&options, NULL, single_point);
+    simulate(&options, &points, two_point);
+
+    printf("Sleep clock:  %.0fHz at 25degC, %+.0fppm/degC, %+.1fppm/degC^2\n", options.clock_hz, options.tempco_ppm,
+           options.curvature_ppm);
+    printf("Temperature:  %.1f+-%.1fdegC daily, %u days\n", options.mean_celsius, options.swing_celsius, options.days);
+    printf("Two point:    %luHz at sensor %u (%.1fdegC), %luHz at sensor %u (%.1fdegC)\n",
+           (unsigned long)points.clock_calibration_low, (unsigned)points.sensor_low, options.point_celsius[0],
+           (unsigned long)points.clock_calibration_high, (unsigned)points.sensor_high, options.point_celsius[1]);
+    print_errors("Single point", single_point);
+    print_errors("Two point", two_point);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/// @file eeprom_decode.cpp
+/// Host tool: turn an eeprom dump of a device into a readable report. Decodes the clock calibration, the
+/// configuration block, the schedule checkpoint, the lifetime statistics and the event log.
+///
+/// Read the eeprom with: avrdude -c stk500v1 -P COM6 -b 115200 -p t85 -U eeprom:r:dump.bin:r
+/// Raw binary dumps and Intel HEX files are accepted.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o eeprom_decode tools/eeprom_decode.cpp
+/// Usage: eeprom_decode [--24v] dump.bin
+#include <stdio.h>
+#include <string.h>
+#include "eeprom_image.h"
+
+/// Read a little-endian value from the dump.
+///
+/// @param data The first byte.
+/// @param length The amount of bytes.
+/// @return The value.
+static uint32_t read_le(const uint8_t* data, uint8_t length) {
+    uint32_t value = 0u;
+    while (length-- > 0u) {
+        value = (value << 8u) | data[length];
+    }
+    return value;
+}
+
+/// Convert a raw battery measurement to volts.
+///
+/// @param adc The 10 bit adc value.
+/// @param _12_24V_selection True: 12V voltage divider, false: 24V voltage divider.
+/// @return The battery voltage.
+static double adc_to_voltage(uint16_t adc, bool _12_24V_selection) {
+    double r2 = (double)(_12_24V_selection ? VOLTAGE_DIVIDER_R2_12V_OHM : VOLTAGE_DIVIDER_R2_24V_OHM);
+    return adc / 1023.0 * (ADC_REFERENCE_MV / 1000.0) * ((r2 + VOLTAGE_DIVIDER_R1_OHM) / r2);
+}
+
+/// Print the clock calibration and the configuration block, as the firmware reads them at startup.
+///
+/// @param image The eeprom dump.
+static void print_config(const eeprom_image_t* image) {
+    eeprom_config_t config;
+    uint32_t clock_calibration;
+
+    if (eeprom_image_get_legacy_calibration(image, &clock_calibration)) {
+        printf("Clock calibration:    %luHz (legacy)\n", (unsigned long)clock_calibration);
+    }
+
+    if (!eeprom_image_get_config(image, &config)) {
+        printf("Configuration:        %s, compiled defaults in use\n",
+               (config.magic_number == EEPROM_CONFIG_MAGIC_NUMBER) ? "invalid" : "not present");
+        return;
+    }
+
+    // The stored version, the block is already converted to the current one.
+    printf("Configuration:        version %u, event log %s\n", (unsigned)image->data[EEPROM_ADDR_CONFIG + 1u],
+           (config.flags & EEPROM_CONFIG_FLAG_EVENT_LOG) ? "on" : "off");
+    if (config.flags & EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION) {
+        printf("Clock calibration:    %luHz at sensor %u, %luHz at sensor %u\n", (unsigned long)config.clock_calibration,
+               (unsigned)config.calibration_sensor_low, (unsigned long)config.clock_calibration_high,
+               (unsigned)config.calibration_sensor_high);
+    } else if (config.flags & EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION) {
+        printf("Clock calibration:    %luHz\n", (unsigned long)config.clock_calibration);
+    } else if (eeprom_image_get_legacy_calibration(image, &clock_calibration)) {
+        printf("Clock calibration:    none in the block, the legacy one is used\n");
+    }
+    printf("12V on/off/threshold: %u/%u wakeups, %u (%.2fV)\n", (unsigned)config.parameters.timing_cycles_load_on_12v,
+           (unsigned)config.parameters.timing_cycles_load_off_12v, (unsigned)config.parameters.adc_threshold_12v,
+           adc_to_voltage(config.parameters.adc_threshold_12v, true));
+    printf("24V on/off/threshold: %u/%u wakeups, %u (%.2fV)\n", (unsigned)config.parameters.timing_cycles_load_on_24v,
+           (unsigned)config.parameters.timing_cycles_load_off_24v, (unsigned)config.parameters.adc_threshold_24v,
+           adc_to_voltage(config.parameters.adc_threshold_24v, false));
+}
+
+/// Print the stack headroom stored by a firmware built with STACK_WATERMARK_MODE, if any.
+///
+/// @param image The eeprom dump.
+static void print_stack_headroom(const eeprom_image_t* image) {
+    uint16_t headroom = ((uint16_t)image->data[EEPROM_ADDR_STACK_HEADROOM_MSB] << 8u) | image->data[EEPROM_ADDR_STACK_HEADROOM_LSB];
+
+    // Erased: not written by a regular firmware.
+    if (headroom != 0xFFFFu) {
+        printf("Stack headroom:       %u bytes (smallest seen)\n", (unsigned)headroom);
+    }
+}
+
+/// Print the newest schedule checkpoint: jumper settings and the phase of the load.
+///
+/// @param image The eeprom dump.
+static void print_checkpoint(const eeprom_image_t* image) {
+    const eeprom_image_ring_t* ring = &eeprom_image_rings[EEPROM_IMAGE_RING_CHECKPOINT];
+    int slot;
+
+    eeprom_image_ring_scan(image, ring, &slot);
+    if (slot < 0) {
+        printf("Checkpoint:           none\n");
+        return;
+    }
+
+    const uint8_t* record = eeprom_image_ring_slot(image, ring, slot);
+    printf("Checkpoint:           %s, %s, load %s for %u wakeups\n", (record[1] & CHECKPOINT_FLAG_12V) ? "12V" : "24V",
+           (record[1] & CHECKPOINT_FLAG_ALL_FEATURES) ? "all features" : "undervoltage protection only",
+           (record[1] & CHECKPOINT_FLAG_LOAD_OFF) ? "off" : "on", ((unsigned)record[2] << 8u) | record[3]);
+}
+
+/// Print the newest lifetime statistics record.
+///
+/// @param image The eeprom dump.
+/// @param _12_24V_selection True: 12V voltage divider, false: 24V voltage divider.
+static void print_lifetime_stats(const eeprom_image_t* image, bool _12_24V_selection) {
+    const eeprom_image_ring_t* ring = &eeprom_image_rings[EEPROM_IMAGE_RING_LIFETIME_STATS];
+    int slot;
+
+    eeprom_image_ring_scan(image, ring, &slot);
+    if (slot < 0) {
+        printf("Lifetime statistics:  none\n");
+        return;
+    }
+
+    const uint8_t* record = eeprom_image_ring_slot(image, ring, slot) + 1u;
+    uint16_t voltage_min = (uint16_t)read_le(&record[0], 2u);
+    uint16_t voltage_max = (uint16_t)read_le(&record[2], 2u);
+    uint32_t load_on_wakeups = read_le(&record[4], 4u);
+
+    printf("Lifetime statistics:\n");
+    if (voltage_min <= voltage_max) {
+        printf("  Battery voltage:    %u..%u (%.2fV..%.2fV)\n", (unsigned)voltage_min, (unsigned)voltage_max,
+               adc_to_voltage(voltage_min, _12_24V_selection), adc_to_voltage(voltage_max, _12_24V_selection));
+    }
+    printf("  Load on:            %lu wakeups (%.1fh nominal)\n", (unsigned long)load_on_wakeups,
+           load_on_wakeups * (double)SLEEP_CLOCK_CYCLES_PER_WAKEUP / SLEEP_CLOCK_VALUE_HZ / 3600.0);
+    printf("  Measurements:       %lu\n", (unsigned long)read_le(&record[8], 4u));
+    printf("  Undervoltage trips: %lu\n", (unsigned long)read_le(&record[12], 2u));
+    printf("  Resets:             %u%s\n", (unsigned)record[14], (record[14] == 0xFFu) ? "+" : "");
+}
+
+/// Print the event log, oldest entry first.
+///
+/// @param image The eeprom dump.
+/// @param _12_24V_selection True: 12V voltage divider, false: 24V voltage divider.
+static void print_event_log(const eeprom_image_t* image, bool _12_24V_selection) {
+    const eeprom_image_ring_t* ring = &eeprom_image_rings[EEPROM_IMAGE_RING_EVENT_LOG];
+    int newest;
+
+    eeprom_image_ring_scan(image, ring, &newest);
+    printf("Event log:\n");
+    if (newest < 0) {
+        return;
+    }
+
+    // Oldest record first.
+    for (int slot = newest + 1; slot <= newest + ring->slot_count; slot++) {
+        const uint8_t* record = eeprom_image_ring_slot(image, ring, slot);
+        uint16_t data = ((uint16_t)record[2] << 8u) | record[3];
+
+        if (record[0] == EEPROM_RING_SEQUENCE_ERASED) {
+            continue;
+        }
+
+        printf("  #%3u ", (unsigned)record[0]);
+        switch (record[1]) {
+        case EVENT_LOG_RESET:
+            printf("reset:%s%s%s%s\n", (data & 0x01u) ? " power-on" : "", (data & 0x02u) ? " external" : "",
+                   (data & 0x04u) ? " brown-out" : "", (data & 0x08u) ? " watchdog" : "");
+            break;
+        case EVENT_LOG_UNDERVOLTAGE_TRIP:
+            printf("undervoltage trip at %u (%.2fV)\n", (unsigned)data, adc_to_voltage(data, _12_24V_selection));
+            break;
+        case EVENT_LOG_LOAD_CYCLES:
+            printf("%u load cycles since reset\n", (unsigned)data);
+            break;
+        default:
+            printf("unknown event %u, data %u\n", (unsigned)record[1], (unsigned)data);
+            break;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    eeprom_image_t image;
+    const char* dump_filename = NULL;
+    const char* error = NULL;
+    bool _12_24V_selection = true;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--24v") == 0) {
+            _12_24V_selection = false;
+        } else {
+            dump_filename = argv[arg];
+        }
+    }
+    if (dump_filename == NULL) {
+        fprintf(stderr, "Usage: eeprom_decode [--24v] dump.bin\n");
+        return 2;
+    }
+
+    if (!eeprom_image_read(&image, dump_filename, &error)) {
+        fprintf(stderr, "%s: %s\n", dump_filename, error);
+        return 2;
+    }
+
+    printf("Eeprom dump:          %s\n", dump_filename);
+    print_config(&image);
+    print_stack_headroom(&image);
+    print_checkpoint(&image);
+    print_lifetime_stats(&image, _12_24V_selection);
+    print_event_log(&image, _12_24V_selection);
+
+    // Problems are reported after the content, the dump may still be worth a look.
+    return (eeprom_image_check(&image, stdout) == 0u) ? 0 : 1;
+}
@@ -0,0 +1,408 @@
+/// @file eeprom_image.h
+/// Host library: build, check, store and read back eeprom images of the device. The addresses and record formats
+/// come from the firmware headers (`eeprom_layout.h`, `eeprom_config.h`), so a new eeprom field is added once for
+/// the firmware and all host tools.
+///
+/// An image only remembers the bytes that were set. Intel HEX output holds just these bytes, so writing it leaves the
+/// rest of the eeprom (e.g. the logs) untouched, raw binary output is padded with 0xFF like an erased eeprom.
+///
+/// Header only, include it from a tool in this folder and build with `-Iinclude`.
+#ifndef EEPROM_IMAGE_H
+#define EEPROM_IMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "eeprom_config.h"
+#include "eeprom_layout.h"
+
+/// The amount of data bytes per Intel HEX record.
+#define EEPROM_IMAGE_HEX_RECORD_LENGTH 16u
+
+/// The maximum length of an Intel HEX line, including the line ending.
+#define EEPROM_IMAGE_HEX_LINE_LENGTH 600u
+
+static_assert(EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER < EEPROM_ADDR_CONFIG, "Legacy calibration overlaps the configuration.");
+static_assert(EEPROM_ADDR_CONFIG_END <= EEPROM_ADDR_CHECKPOINT, "Configuration overlaps the checkpoint ring.");
+static_assert(EEPROM_ADDR_CHECKPOINT + EEPROM_CHECKPOINT_RECORD_SIZE * EEPROM_CHECKPOINT_RECORDS <= EEPROM_ADDR_LIFETIME_STATS,
+              "Checkpoint ring overlaps the lifetime statistics ring.");
+static_assert(EEPROM_ADDR_LIFETIME_STATS + EEPROM_LIFETIME_STATS_RECORD_SIZE * EEPROM_LIFETIME_STATS_RECORDS <= EEPROM_ADDR_EVENT_LOG,
+              "Lifetime statistics ring overlaps the event log ring.");
+static_assert(EEPROM_ADDR_EVENT_LOG + EEPROM_EVENT_LOG_RECORD_SIZE * EEPROM_EVENT_LOG_RECORDS <= EEPROM_SIZE_BYTES,
+              "Event log ring exceeds the eeprom.");
+
+/// The content of the eeprom.
+typedef struct eeprom_image {
+    uint8_t data[EEPROM_SIZE_BYTES];
+
+    /// True for every byte that was set or read back.
+    bool used[EEPROM_SIZE_BYTES];
+} eeprom_image_t;
+
+/// A wear leveled ring of the eeprom layout.
+typedef struct eeprom_image_ring {
+    const char* name;
+    uint16_t address;
+    uint8_t slot_size;
+    uint8_t slot_count;
+} eeprom_image_ring_t;
+
+/// All rings of the eeprom layout.
+static const eeprom_image_ring_t eeprom_image_rings[] = {
+    {"checkpoint", EEPROM_ADDR_CHECKPOINT, EEPROM_CHECKPOINT_RECORD_SIZE, EEPROM_CHECKPOINT_RECORDS},
+    {"lifetime statistics", EEPROM_ADDR_LIFETIME_STATS, EEPROM_LIFETIME_STATS_RECORD_SIZE, EEPROM_LIFETIME_STATS_RECORDS},
+    {"event log", EEPROM_ADDR_EVENT_LOG, EEPROM_EVENT_LOG_RECORD_SIZE, EEPROM_EVENT_LOG_RECORDS},
+};
+
+/// Indices into @ref eeprom_image_rings.
+enum eeprom_image_ring_index {
+    EEPROM_IMAGE_RING_CHECKPOINT,
+    EEPROM_IMAGE_RING_LIFETIME_STATS,
+    EEPROM_IMAGE_RING_EVENT_LOG,
+};
+
+/// Start an empty image, all bytes erased (0xFF) and unused.
+///
+/// @param image The image.
+static inline void eeprom_image_init(eeprom_image_t* image) {
+    memset(image->data, 0xFF, sizeof(image->data));
+    memset(image->used, 0, sizeof(image->used));
+}
+
+/// Set bytes of the image.
+///
+/// @param image The image.
+/// @param address The eeprom address.
+/// @param data The data.
+/// @param length The amount of bytes.
+/// @return False if the data exceeds the eeprom, the image is not changed.
+static inline bool eeprom_image_set(eeprom_image_t* image, uint16_t address, const void* data, uint16_t length) {
+    if ((uint32_t)address + length > EEPROM_SIZE_BYTES) {
+        return false;
+    }
+
+    memcpy(&image->data[address], data, length);
+    memset(&image->used[address], 1, length);
+    return true;
+}
+
+/// Check a clock calibration value against the limits of the firmware (see `apply_clock_calibration()`).
+///
+/// @param clock_calibration The measured sleep clock frequency in Hz.
+/// @return True if the firmware applies the value.
+static inline bool eeprom_image_calibration_valid(uint32_t clock_calibration) {
+    return (clock_calibration >= SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ) &&
+           (clock_calibration <= SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ);
+}
+
+/// Convert a temperature to the typical reading of the internal temperature sensor, interpolated from the
+/// datasheet table (230 at -40degC, 300 at 25degC, 370 at 85degC, pg. 134). The offset of a chip can be +-10degC.
+///
+/// @param celsius The temperature in degC.
+/// @return The raw 10 bit sensor value, rounded.
+static inline uint16_t eeprom_image_temperature_to_sensor(double celsius) {
+    double sensor = (celsius < 25.0) ? (300.0 + (celsius - 25.0) * (70.0 / 65.0)) : (300.0 + (celsius - 25.0) * (70.0 / 60.0));
+    return (sensor <= 0.0) ? 0u : (sensor >= 1023.0) ? 1023u : (uint16_t)(sensor + 0.5);
+}
+
+/// Set the legacy clock calibration record: 4 bytes big-endian and the magic number.
+///
+/// @param image The image.
+/// @param clock_calibration The measured sleep clock frequency in Hz.
+static inline void eeprom_image_set_legacy_calibration(eeprom_image_t* image, uint32_t clock_calibration) {
+    uint8_t record[EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER + 1u];
+
+    record[EEPROM_ADDR_CLOCK_CALIB_3_MSB] = (uint8_t)(clock_calibration >> 24u);
+    record[EEPROM_ADDR_CLOCK_CALIB_2] = (uint8_t)(clock_calibration >> 16u);
+    record[EEPROM_ADDR_CLOCK_CALIB_1] = (uint8_t)(clock_calibration >> 8u);
+    record[EEPROM_ADDR_CLOCK_CALIB_0_LSB] = (uint8_t)clock_calibration;
+    record[EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER] = EEPROM_CLOCK_CALIB_MAGIC_NUMBER;
+    eeprom_image_set(image, EEPROM_ADDR_CLOCK_CALIB_3_MSB, record, sizeof(record));
+}
+
+/// Read the legacy clock calibration record.
+///
+/// @param image The image.
+/// @param clock_calibration The stored frequency in Hz.
+/// @return True if the magic number is present.
+static inline bool eeprom_image_get_legacy_calibration(const eeprom_image_t* image, uint32_t* clock_calibration) {
+    const uint8_t* record = &image->data[EEPROM_ADDR_CLOCK_CALIB_3_MSB];
+
+    *clock_calibration = ((uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_3_MSB] << 24u) |
+                         ((uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_2] << 16u) |
+                         ((uint32_t)record[EEPROM_ADDR_CLOCK_CALIB_1] << 8u) | record[EEPROM_ADDR_CLOCK_CALIB_0_LSB];
+    return record[EEPROM_ADDR_CLOCK_CALIB_MAGIC_NUMBER] == EEPROM_CLOCK_CALIB_MAGIC_NUMBER;
+}
+
+/// Set the configuration block, the crc is calculated.
+///
+/// @param image The image.
+/// @param config The configuration block, its crc is updated.
+static inline void eeprom_image_set_config(eeprom_image_t* image, eeprom_config_t* config) {
+    config->crc = eeprom_config_crc(config);
+    eeprom_image_set(image, EEPROM_ADDR_CONFIG, config, sizeof(eeprom_config_t));
+}
+
+/// Read the configuration block, a valid block of a previous version is converted like the firmware does.
+///
+/// @param image The image.
+/// @param config The configuration block.
+/// @return True if the firmware accepts the block.
+static inline bool eeprom_image_get_config(const eeprom_image_t* image, eeprom_config_t* config) {
+    memcpy(config, &image->data[EEPROM_ADDR_CONFIG], sizeof(eeprom_config_t));
+    if (!eeprom_config_valid(config)) {
+        return false;
+    }
+    eeprom_config_upgrade(config);
+    return true;
+}
+
+/// Get a slot of a ring.
+///
+/// @param image The image.
+/// @param ring The ring.
+/// @param slot The slot index, wraps around.
+/// @return The sequence number of the slot, followed by the payload.
+static inline const uint8_t* eeprom_image_ring_slot(const eeprom_image_t* image, const eeprom_image_ring_t* ring, int slot) {
+    return &image->data[ring->address + (slot % ring->slot_count) * ring->slot_size];
+}
+
+/// Count the records of a ring that are not followed by the next record, same scan as `eeprom_ring_init()`.
+///
+/// @param image The image.
+/// @param ring The ring.
+/// @param newest_slot The first such record, the newest one. -1 if the ring is empty.
+/// @return The amount of such records, more than one means the ring is corrupted.
+static inline uint8_t eeprom_image_ring_scan(const eeprom_image_t* image, const eeprom_image_ring_t* ring, int* newest_slot) {
+    uint8_t ends = 0u;
+
+    *newest_slot = -1;
+    for (uint8_t slot = 0u; slot < ring->slot_count; slot++) {
+        uint8_t sequence = eeprom_image_ring_slot(image, ring, slot)[0];
+        if (sequence == EEPROM_RING_SEQUENCE_ERASED) {
+            continue;
+        }
+
+        uint8_t next_sequence = (sequence + 1u < EEPROM_RING_SEQUENCE_MODULO) ? (sequence + 1u) : 0u;
+        if (eeprom_image_ring_slot(image, ring, slot + 1)[0] != next_sequence) {
+            if (ends++ == 0u) {
+                *newest_slot = slot;
+            }
+        }
+    }
+    return ends;
+}
+
+/// Check the layout of an image: configuration block, clock calibration and the rings.
+/// A block without clock calibration next to a legacy record is reported as a warning, the firmware then uses the
+/// legacy calibration (@ref eeprom_config_legacy_calibration).
+///
+/// @param image The image.
+/// @param report Receives a line per problem and per warning, may be NULL.
+/// @return The amount of problems, warnings are not counted.
+static inline unsigned eeprom_image_check(const eeprom_image_t* image, FILE* report) {
+    unsigned problems = 0u;
+    uint32_t clock_calibration;
+    eeprom_config_t config;
+
+    if (eeprom_image_get_legacy_calibration(image, &clock_calibration) && !eeprom_image_calibration_valid(clock_calibration)) {
+        if (report != NULL) {
+            fprintf(report, "Legacy clock calibration %luHz is ignored by the firmware.\n", (unsigned long)clock_calibration);
+        }
+        problems++;
+    }
+
+    bool config_valid = eeprom_image_get_config(image, &config);
+    if (!config_valid && config.magic_number == EEPROM_CONFIG_MAGIC_NUMBER) {
+        if (report != NULL) {
+            fprintf(report, "Configuration block version %u is invalid (crc, version or parameter range).\n",
+                    (unsigned)config.version);
+        }
+        problems++;
+    }
+    if (config_valid && (config.flags & EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION) &&
+        !eeprom_image_calibration_valid(config.clock_calibration)) {
+        if (report != NULL) {
+            fprintf(report, "Configured clock calibration %luHz is ignored by the firmware.\n",
+                    (unsigned long)config.clock_calibration);
+        }
+        problems++;
+    }
+    if (config_valid && !(config.flags & EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION) &&
+        eeprom_image_get_legacy_calibration(image, &clock_calibration) && report != NULL) {
+        fprintf(report, "Warning: the configuration block has no clock calibration, the legacy one (%luHz) is used.\n",
+                (unsigned long)clock_calibration);
+    }
+
+    for (const eeprom_image_ring_t& ring : eeprom_image_rings) {
+        int newest_slot;
+        if (eeprom_image_ring_scan(image, &ring, &newest_slot) > 1u) {
+            if (report != NULL) {
+                fprintf(report, "The %s ring at 0x%03X is not contiguous.\n", ring.name, (unsigned)ring.address);
+            }
+            problems++;
+        }
+    }
+
+    return problems;
+}
+
+/// Write the image as raw binary, from address 0 up to the last used byte.
+///
+/// @param image The image.
+/// @param f_handle The output file, opened in binary mode.
+/// @return True on success.
+static inline bool eeprom_image_write_bin(const eeprom_image_t* image, FILE* f_handle) {
+    uint16_t length = EEPROM_SIZE_BYTES;
+
+    while (length > 0u && !image->used[length - 1u]) {
+        length--;
+    }
+    return fwrite(image->data, 1u, length, f_handle) == length;
+}
+
+/// Write the used bytes of the image as Intel HEX.
+///
+/// @param image The image.
+/// @param f_handle The output file.
+/// @return True on success.
+static inline bool eeprom_image_write_hex(const eeprom_image_t* image, FILE* f_handle) {
+    uint16_t address = 0u;
+
+    while (address < EEPROM_SIZE_BYTES) {
+        if (!image->used[address]) {
+            address++;
+            continue;
+        }
+
+        uint8_t record_length = 0u;
+        while (record_length < EEPROM_IMAGE_HEX_RECORD_LENGTH && address + record_length < EEPROM_SIZE_BYTES &&
+               image->used[address + record_length]) {
+            record_length++;
+        }
+
+        uint8_t checksum = record_length + (uint8_t)(address >> 8u) + (uint8_t)address;
+        fprintf(f_handle, ":%02X%04X00", record_length, address);
+        for (uint8_t byte_index = 0u; byte_index < record_length; byte_index++) {
+            fprintf(f_handle, "%02X", image->data[address + byte_index]);
+            checksum += image->data[address + byte_index];
+        }
+        fprintf(f_handle, "%02X\n", (uint8_t)(0u - checksum));
+        address += record_length;
+    }
+    fprintf(f_handle, ":00000001FF\n");
+    return ferror(f_handle) == 0;
+}
+
+/// Write the image to a file, raw binary if the name ends with `.bin`, Intel HEX otherwise.
+///
+/// @param image The image.
+/// @param filename The output file.
+/// @return True on success.
+static inline bool eeprom_image_write_file(const eeprom_image_t* image, const char* filename) {
+    size_t filename_length = strlen(filename);
+    bool binary = (filename_length >= 4u) && (strcmp(&filename[filename_length - 4u], ".bin") == 0);
+    FILE* f_handle = fopen(filename, binary ? "wb" : "w");
+
+    if (f_handle == NULL) {
+        return false;
+    }
+    bool result = binary ? eeprom_image_write_bin(image, f_handle) : eeprom_image_write_hex(image, f_handle);
+    return (fclose(f_handle) == 0) && result;
+}
+
+/// Parse two hex digits.
+///
+/// @param text The digits.
+/// @param value The parsed value.
+/// @return False if the text holds no valid hex digits.
+static inline bool eeprom_image_parse_hex_byte(const char* text, uint8_t* value) {
+    *value = 0u;
+    for (uint8_t digit_index = 0u; digit_index < 2u; digit_index++) {
+        char digit = text[digit_index];
+        uint8_t nibble;
+        if (digit >= '0' && digit <= '9') {
+            nibble = (uint8_t)(digit - '0');
+        } else if (digit >= 'A' && digit <= 'F') {
+            nibble = (uint8_t)(digit - 'A' + 10);
+        } else if (digit >= 'a' && digit <= 'f') {
+            nibble = (uint8_t)(digit - 'a' + 10);
+        } else {
+            return false;
+        }
+        *value = (uint8_t)((*value << 4u) | nibble);
+    }
+    return true;
+}
+
+/// Read Intel HEX into the image.
+///
+/// @param image The initialized image.
+/// @param f_handle The input file.
+/// @param error Receives a description of the first problem.
+/// @return False on a malformed record or data outside of the eeprom.
+static inline bool eeprom_image_read_hex(eeprom_image_t* image, FILE* f_handle, const char** error) {
+    char line[EEPROM_IMAGE_HEX_LINE_LENGTH];
+
+    while (fgets(line, sizeof(line), f_handle) != NULL) {
+        uint8_t record[EEPROM_IMAGE_HEX_LINE_LENGTH / 2u];
+        uint16_t record_length = 0u;
+        uint8_t checksum = 0u;
+
+        if (line[0] != ':') {
+            continue;
+        }
+        for (const char* text = &line[1]; eeprom_image_parse_hex_byte(text, &record[record_length]); text += 2) {
+            checksum += record[record_length++];
+        }
+        if (record_length < 5u || record_length != record[0] + 5u || checksum != 0u) {
+            *error = "malformed Intel HEX record";
+            return false;
+        }
+
+        if (record[3] == 0x01u) {
+            return true;
+        }
+        if (record[3] == 0x00u && !eeprom_image_set(image, (uint16_t)((record[1] << 8u) | record[2]), &record[4], record[0])) {
+            *error = "Intel HEX data outside of the eeprom";
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Read an image back from a file: Intel HEX if it starts with ':', raw binary otherwise (e.g. an avrdude dump).
+///
+/// @param image The image, initialized by this function.
+/// @param filename The file to read.
+/// @param error Receives a description of the problem.
+/// @return False if the file can't be read.
+static inline bool eeprom_image_read(eeprom_image_t* image, const char* filename, const char** error) {
+    FILE* f_handle = fopen(filename, "rb");
+    bool result = true;
+
+    eeprom_image_init(image);
+    if (f_handle == NULL) {
+        *error = "can't open file";
+        return false;
+    }
+
+    int first = fgetc(f_handle);
+    if (first == ':') {
+        ungetc(first, f_handle);
+        result = eeprom_image_read_hex(image, f_handle, error);
+    } else if (first != EOF) {
+        image->data[0] = (uint8_t)first;
+        size_t length = 1u + fread(&image->data[1], 1u, EEPROM_SIZE_BYTES - 1u, f_handle);
+        memset(image->used, 1, length);
+        if (fgetc(f_handle) != EOF) {
+            *error = "file is bigger than the eeprom";
+            result = false;
+        }
+    }
+
+    fclose(f_handle);
+    return result;
+}
+
+#endif // EEPROM_IMAGE_H
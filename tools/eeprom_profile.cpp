@@ -0,0 +1,253 @@
+/// @file eeprom_profile.cpp
+/// Host tool: generate the eeprom configuration block (see `eeprom_config.h`) with custom on/off times,
+/// undervoltage thresholds and clock calibration. Only the eeprom has to be written to change the
+/// behaviour of a device, which is much faster than reflashing with the slow programming clock.
+///
+/// The output is an Intel HEX file holding only the configuration block at its eeprom address, the logs
+/// in the rest of the eeprom are left untouched. A profile without `--calibration` keeps using the legacy
+/// clock calibration record of the chip (written by fleet_calibration), a profile with one replaces it.
+/// A name ending with `.bin` selects a raw binary image instead.
+///
+/// With `--fleet` a list of chips (`chip_id,calibration_hz` per line) is streamed and an image with the
+/// configuration and the clock calibration of each chip is written to `<prefix><chip_id>.hex`/`.bin`.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o eeprom_profile tools/eeprom_profile.cpp
+/// Usage: eeprom_profile [--on-12v H] [--off-12v H] [--on-24v H] [--off-24v H] [--threshold-12v V]
+///                       [--threshold-24v V] [--calibration HZ] [--two-point C1:HZ1,C2:HZ2] [--no-event-log]
+///                       -o profile.hex
+///        eeprom_profile [options] [--bin] --fleet chips.csv -o prefix_
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eeprom_image.h"
+
+/// The maximum length of a line of the fleet list.
+#define FLEET_LINE_LENGTH 256u
+
+/// Convert hours to wakeup cycles (8.192s per cycle).
+///
+/// @param hours The duration in hours.
+/// @return The amount of wakeup cycles, rounded.
+static long hours_to_cycles(double hours) {
+    return lround(hours * 3600.0 * SLEEP_CLOCK_VALUE_HZ / SLEEP_CLOCK_CYCLES_PER_WAKEUP);
+}
+
+/// Convert a battery voltage to the raw adc value of the firmware's battery measurement.
+///
+/// @param voltage The battery voltage in volts.
+/// @param _12_24V_selection True: 12V voltage divider, false: 24V voltage divider.
+/// @return The raw 10 bit adc value, rounded.
+static long voltage_to_adc(double voltage, bool _12_24V_selection) {
+    double r2 = (double)(_12_24V_selection ? VOLTAGE_DIVIDER_R2_12V_OHM : VOLTAGE_DIVIDER_R2_24V_OHM);
+    return lround(voltage * (r2 / (r2 + VOLTAGE_DIVIDER_R1_OHM)) * (1000.0 / ADC_REFERENCE_MV) * 1023.0);
+}
+
+/// Write an image, report a failure.
+///
+/// @param image The image.
+/// @param filename The output file, raw binary if the name ends with `.bin`.
+/// @return True on success.
+static bool write_image(const eeprom_image_t* image, const char* filename) {
+    if (!eeprom_image_write_file(image, filename)) {
+        fprintf(stderr, "Writing '%s' failed.\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/// Stream a fleet list and write an image per chip. The configuration is written together with the
+/// legacy calibration record, so the images also work with firmware without configuration block.
+///
+/// @param config The configuration shared by all chips.
+/// @param fleet_filename The list, one `chip_id,calibration_hz` per line, '#' starts a comment. "-" for stdin.
+/// @param prefix The start of the output file names.
+/// @param suffix ".hex" or ".bin".
+/// @return The exit code.
+static int write_fleet(eeprom_config_t config, const char* fleet_filename, const char* prefix, const char* suffix) {
+    FILE* f_handle = (strcmp(fleet_filename, "-") == 0) ? stdin : fopen(fleet_filename, "r");
+    char line[FLEET_LINE_LENGTH];
+    unsigned line_number = 0u;
+    unsigned chips = 0u;
+    int result = 0;
+
+    if (f_handle == NULL) {
+        perror(fleet_filename);
+        return 1;
+    }
+
+    while (result == 0 && fgets(line, sizeof(line), f_handle) != NULL) {
+        unsigned long chip_id;
+        unsigned long clock_calibration;
+        eeprom_image_t image;
+        char filename[FLEET_LINE_LENGTH + 32u];
+
+        line_number++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%lu , %lu", &chip_id, &clock_calibration) != 2) {
+            fprintf(stderr, "%s:%u: expected 'chip_id,calibration_hz'.\n", fleet_filename, line_number);
+            result = 1;
+            break;
+        }
+        if (!eeprom_image_calibration_valid((uint32_t)clock_calibration)) {
+            fprintf(stderr, "%s:%u: clock calibration %luHz of chip %lu is out of the accepted range.\n", fleet_filename,
+                    line_number, clock_calibration, chip_id);
+            result = 1;
+            break;
+        }
+
+        // The measured frequency of the chip replaces a two point calibration of the profile.
+        config.clock_calibration = (uint32_t)clock_calibration;
+        config.flags |= EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION;
+        config.flags &= (uint8_t)~EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION;
+
+        eeprom_image_init(&image);
+        eeprom_image_set_legacy_calibration(&image, (uint32_t)clock_calibration);
+        eeprom_image_set_config(&image, &config);
+        snprintf(filename, sizeof(filename), "%s%03lu%s", prefix, chip_id, suffix);
+        if (eeprom_image_check(&image, stderr) != 0u || !write_image(&image, filename)) {
+            result = 1;
+            break;
+        }
+        chips++;
+    }
+
+    if (f_handle != stdin) {
+        fclose(f_handle);
+    }
+    printf("Wrote %u images.\n", chips);
+    return result;
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: eeprom_profile [options] -o profile.hex\n"
+            "  --on-12v H, --off-12v H     Load on/off time in hours, 12V jumper setting\n"
+            "  --on-24v H, --off-24v H     Load on/off time in hours, 24V jumper setting\n"
+            "  --threshold-12v V           Undervoltage threshold in volts, 12V jumper setting\n"
+            "  --threshold-24v V           Undervoltage threshold in volts, 24V jumper setting\n"
+            "  --calibration HZ            Measured sleep clock frequency of the chip\n"
+            "  --two-point C1:HZ1,C2:HZ2   Sleep clock frequency measured at two temperatures in degC\n"
+            "  --no-event-log              Disable the event log\n"
+            "  --fleet chips.csv           Write an image per chip to <-o prefix><chip_id>.hex\n"
+            "  --bin                       Fleet images as raw binary\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    eeprom_config_t config;
+    const char* output_filename = NULL;
+    const char* fleet_filename = NULL;
+    const char* fleet_suffix = ".hex";
+    eeprom_image_t image;
+    long value = 0;
+
+    eeprom_config_defaults(&config);
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+        const char* argument = ((arg + 1) < argc) ? argv[arg + 1] : NULL;
+
+        if (strcmp(option, "--no-event-log") == 0) {
+            config.flags &= (uint8_t)~EEPROM_CONFIG_FLAG_EVENT_LOG;
+            continue;
+        }
+        if (strcmp(option, "--bin") == 0) {
+            fleet_suffix = ".bin";
+            continue;
+        }
+        if (argument == NULL) {
+            print_usage();
+        }
+        arg++;
+
+        if (strcmp(option, "-o") == 0) {
+            output_filename = argument;
+        } else if (strcmp(option, "--fleet") == 0) {
+            fleet_filename = argument;
+        } else if (strcmp(option, "--calibration") == 0) {
+            value = strtol(argument, NULL, 0);
+            if (value < 0 || !eeprom_image_calibration_valid((uint32_t)value)) {
+                fprintf(stderr, "Clock calibration %ldHz is out of the accepted range.\n", value);
+                return 1;
+            }
+            config.clock_calibration = (uint32_t)value;
+            config.flags &= (uint8_t)~EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION;
+            config.flags |= EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION;
+        } else if (strcmp(option, "--two-point") == 0) {
+            double celsius[2];
+            unsigned long frequency[2];
+            clock_calibration_points_t points;
+
+            // The sensor readings are the typical values, the chip's own offset is not known here.
+            if (sscanf(argument, "%lf:%lu,%lf:%lu", &celsius[0], &frequency[0], &celsius[1], &frequency[1]) != 4) {
+                print_usage();
+            }
+            uint8_t low = (celsius[0] <= celsius[1]) ? 0u : 1u;
+            points.sensor_low = eeprom_image_temperature_to_sensor(celsius[low]);
+            points.sensor_high = eeprom_image_temperature_to_sensor(celsius[1u - low]);
+            points.clock_calibration_low = (uint32_t)frequency[low];
+            points.clock_calibration_high = (uint32_t)frequency[1u - low];
+            if (!clock_calibration_points_valid(&points)) {
+                fprintf(stderr, "Two point calibration %s is out of the accepted range.\n", argument);
+                return 1;
+            }
+
+            config.calibration_sensor_low = points.sensor_low;
+            config.calibration_sensor_high = points.sensor_high;
+            config.clock_calibration = points.clock_calibration_low;
+            config.clock_calibration_high = points.clock_calibration_high;
+            config.flags |= EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION | EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION;
+        } else if (strcmp(option, "--on-12v") == 0) {
+            config.parameters.timing_cycles_load_on_12v = (uint16_t)(value = hours_to_cycles(atof(argument)));
+        } else if (strcmp(option, "--off-12v") == 0) {
+            config.parameters.timing_cycles_load_off_12v = (uint16_t)(value = hours_to_cycles(atof(argument)));
+        } else if (strcmp(option, "--on-24v") == 0) {
+            config.parameters.timing_cycles_load_on_24v = (uint16_t)(value = hours_to_cycles(atof(argument)));
+        } else if (strcmp(option, "--off-24v") == 0) {
+            config.parameters.timing_cycles_load_off_24v = (uint16_t)(value = hours_to_cycles(atof(argument)));
+        } else if (strcmp(option, "--threshold-12v") == 0) {
+            config.parameters.adc_threshold_12v = (uint16_t)(value = voltage_to_adc(atof(argument), true));
+        } else if (strcmp(option, "--threshold-24v") == 0) {
+            config.parameters.adc_threshold_24v = (uint16_t)(value = voltage_to_adc(atof(argument), false));
+        } else {
+            print_usage();
+        }
+
+        if (strncmp(option, "--on", 4) == 0 || strncmp(option, "--off", 5) == 0) {
+            if (value < 1 || value > (long)TIMING_CYCLES_MAX) {
+                fprintf(stderr, "%s %s is out of range (max %.1fh).\n", option, argument,
+                        TIMING_CYCLES_MAX * (double)SLEEP_CLOCK_CYCLES_PER_WAKEUP / SLEEP_CLOCK_VALUE_HZ / 3600.0);
+                return 1;
+            }
+        } else if (strncmp(option, "--threshold", 11) == 0 && (value < 0 || value > 1023)) {
+            fprintf(stderr, "%s %s is out of the measurement range.\n", option, argument);
+            return 1;
+        }
+    }
+
+    if (output_filename == NULL) {
+        print_usage();
+    }
+
+    eeprom_image_init(&image);
+    eeprom_image_set_config(&image, &config);
+    if (eeprom_image_check(&image, stderr) != 0u || !eeprom_config_valid(&config)) {
+        fprintf(stderr, "Generated configuration is invalid.\n");
+        return 1;
+    }
+
+    printf("12V: on %u, off %u wakeups, threshold %u\n", (unsigned)config.parameters.timing_cycles_load_on_12v,
+           (unsigned)config.parameters.timing_cycles_load_off_12v, (unsigned)config.parameters.adc_threshold_12v);
+    printf("24V: on %u, off %u wakeups, threshold %u\n", (unsigned)config.parameters.timing_cycles_load_on_24v,
+           (unsigned)config.parameters.timing_cycles_load_off_24v, (unsigned)config.parameters.adc_threshold_24v);
+    if (fleet_filename != NULL) {
+        return write_fleet(config, fleet_filename, output_filename, fleet_suffix);
+    }
+
+    printf("Writing file '%s'.\n", output_filename);
+    return write_image(&image, output_filename) ? 0 : 1;
+}
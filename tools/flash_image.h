@@ -0,0 +1,104 @@
+/// @file flash_image.h
+/// Host tools: read a firmware image (Intel HEX as built by PlatformIO, or raw binary) into a memory image of the
+/// target. Bytes that the file doesn't set stay erased (0xFF), as on the target after a chip erase.
+/// @author JF
+/// @date May 10, 2023
+#ifndef FLASH_IMAGE_H
+#define FLASH_IMAGE_H
+
+#include <stdio.h>
+#include <string.h>
+#include "eeprom_image.h"
+
+/// The biggest image, a 16 bit address range.
+#define FLASH_IMAGE_SIZE_MAX 0xFFFFu
+
+/// A memory image.
+typedef struct flash_image {
+    uint8_t data[FLASH_IMAGE_SIZE_MAX + 1u];
+
+    /// The end of the last byte set by the file.
+    unsigned long size;
+} flash_image_t;
+
+/// Read Intel HEX into the image, extended segment and linear address records are followed.
+///
+/// @param image The erased image.
+/// @param f_handle The input file.
+/// @param error Receives a description of the first problem.
+/// @return False on a malformed record or data outside of the image.
+static inline bool flash_image_read_hex(flash_image_t* image, FILE* f_handle, const char** error) {
+    char line[EEPROM_IMAGE_HEX_LINE_LENGTH];
+    unsigned long segment = 0u;
+
+    while (fgets(line, sizeof(line), f_handle) != NULL) {
+        uint8_t record[EEPROM_IMAGE_HEX_LINE_LENGTH / 2u];
+        uint16_t record_length = 0u;
+        uint8_t checksum = 0u;
+
+        if (line[0] != ':') {
+            continue;
+        }
+        for (const char* text = &line[1]; eeprom_image_parse_hex_byte(text, &record[record_length]); text += 2) {
+            checksum += record[record_length++];
+        }
+        if (record_length < 5u || record_length != record[0] + 5u || checksum != 0u) {
+            *error = "malformed Intel HEX record";
+            return false;
+        }
+
+        if (record[3] == 0x01u) {
+            return true;
+        }
+        if ((record[3] == 0x02u || record[3] == 0x04u) && record[0] == 2u) {
+            segment = (((unsigned long)record[4] << 8u) | record[5]) << ((record[3] == 0x02u) ? 4u : 16u);
+        } else if (record[3] == 0x00u) {
+            unsigned long address = segment + (((unsigned long)record[1] << 8u) | record[2]);
+            if (address + record[0] > FLASH_IMAGE_SIZE_MAX) {
+                *error = "Intel HEX data outside of the image";
+                return false;
+            }
+            memcpy(&image->data[address], &record[4], record[0]);
+            if (address + record[0] > image->size) {
+                image->size = address + record[0];
+            }
+        }
+    }
+    return true;
+}
+
+/// Read an image from a file: Intel HEX if it starts with ':', raw binary otherwise.
+///
+/// @param image The image, erased by this function.
+/// @param filename The file to read.
+/// @param error Receives a description of the problem.
+/// @return False if the file can't be read or doesn't fit into the image.
+static inline bool flash_image_read(flash_image_t* image, const char* filename, const char** error) {
+    FILE* f_handle = fopen(filename, "rb");
+    bool result = true;
+
+    memset(image->data, 0xFF, sizeof(image->data));
+    image->size = 0u;
+    if (f_handle == NULL) {
+        *error = "can't open file";
+        return false;
+    }
+
+    int first = fgetc(f_handle);
+    if (first == ':') {
+        ungetc(first, f_handle);
+        result = flash_image_read_hex(image, f_handle, error);
+    } else if (first != EOF) {
+        image->data[0] = (uint8_t)first;
+        image->size = 1u + fread(&image->data[1], 1u, FLASH_IMAGE_SIZE_MAX - 1u, f_handle);
+        if (fgetc(f_handle) != EOF) {
+            *error = "file is bigger than the image";
+            result = false;
+        }
+    }
+
+    fclose(f_handle);
+    return result;
+}
+
+#endif // FLASH_IMAGE_H
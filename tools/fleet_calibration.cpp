@@ -0,0 +1,305 @@
+/// @file fleet_calibration.cpp
+/// Host tool: turn the calibration table of a production run into programming jobs. Streams the table of
+/// `clock_calibrations/clock_calibrations.md` (or a `chip_id,frequency_hz` CSV export of it), checks every
+/// entry against the limits of the firmware (@ref SLEEP_CLOCK_DEVIATION_MAX_HZ) and writes per chip an eeprom
+/// image with the clock calibration and the configuration block.
+///
+/// The manifest (`manifest.csv` in the output folder) lists every chip with its image and one avrdude command that
+/// programs the firmware, the eeprom image and the fuses of that chip in a single run. The firmware is the same for
+/// all chips and is referenced, not copied.
+///
+/// Invalid entries, duplicate chip ids and existing images with other content are reported and make the tool exit
+/// with 1, nothing is overwritten without `--force`. Existing identical images are kept, so a rerun is harmless.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o fleet_calibration tools/fleet_calibration.cpp
+/// Usage: fleet_calibration [--firmware firmware.hex] [--config profile.hex] [--out DIR] [--prefix NAME] [--bin]
+///                          [--port PORT] [--force] clock_calibrations.md|chips.csv|-
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include "eeprom_image.h"
+
+/// The maximum length of a line of the table and of a file name.
+#define FLEET_LINE_LENGTH 512u
+
+/// The regular fuses of the firmware, see `main.cpp`.
+#define FLEET_FUSE_LOW 0x62u
+#define FLEET_FUSE_HIGH 0xD7u
+#define FLEET_FUSE_EXTENDED 0xFFu
+
+/// The settings of a run.
+typedef struct fleet_options {
+    const char* firmware_filename;
+    const char* config_filename;
+    const char* output_directory;
+    const char* prefix;
+    const char* suffix;
+    const char* port;
+    bool force;
+} fleet_options_t;
+
+/// Parse an unsigned number that fills the whole field, surrounding blanks are ignored.
+///
+/// @param field The field, modified.
+/// @param value The number.
+/// @return False if the field holds anything else.
+static bool parse_number(char* field, unsigned long* value) {
+    char* end;
+
+    field += strspn(field, " \t");
+    if (*field < '0' || *field > '9') {
+        return false;
+    }
+
+    errno = 0;
+    *value = strtoul(field, &end, 10);
+    return errno == 0 && end[strspn(end, " \t\r\n")] == '\0';
+}
+
+/// Get chip id and frequency of a table row: markdown (`| 1 | 110481 | ... |`) or CSV (`1,110481`).
+///
+/// @param line The line, modified.
+/// @param chip_id The chip id.
+/// @param frequency The measured sleep clock frequency in Hz.
+/// @return False if the line is no data row (text, table header or separator).
+static bool parse_row(char* line, unsigned long* chip_id, unsigned long* frequency) {
+    char separator = ',';
+    char* fields[2];
+
+    line += strspn(line, " \t");
+    if (*line == '|') {
+        separator = '|';
+        line++;
+    }
+
+    for (uint8_t field_index = 0u; field_index < 2u; field_index++) {
+        fields[field_index] = line;
+        line = strchr(line, separator);
+        if (line != NULL) {
+            *line++ = '\0';
+        } else if (field_index == 0u) {
+            return false;
+        } else {
+            // Last field of a CSV line.
+            line = fields[field_index] + strlen(fields[field_index]);
+        }
+    }
+
+    return parse_number(fields[0], chip_id) && parse_number(fields[1], frequency);
+}
+
+/// Check if a file exists.
+///
+/// @param filename The file.
+/// @return True if it can be opened.
+static bool file_exists(const char* filename) {
+    FILE* f_handle = fopen(filename, "rb");
+    if (f_handle == NULL) {
+        return false;
+    }
+    fclose(f_handle);
+    return true;
+}
+
+/// Check if an existing image file holds the same data as an image.
+///
+/// @param filename The image file.
+/// @param image The image.
+/// @return True if the file holds exactly the bytes of the image.
+static bool image_file_matches(const char* filename, const eeprom_image_t* image) {
+    eeprom_image_t existing;
+    const char* error = NULL;
+
+    if (!eeprom_image_read(&existing, filename, &error)) {
+        return false;
+    }
+    for (uint16_t address = 0u; address < EEPROM_SIZE_BYTES; address++) {
+        if (existing.used[address] != image->used[address] ||
+            (image->used[address] && existing.data[address] != image->data[address])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Calculate the crc of a file, to identify the firmware in the manifest.
+///
+/// @param filename The file.
+/// @param crc The crc, see @ref eeprom_crc16.
+/// @return False if the file can't be read.
+static bool file_crc(const char* filename, uint16_t* crc) {
+    FILE* f_handle = fopen(filename, "rb");
+    uint8_t buffer[FLEET_LINE_LENGTH];
+    size_t length;
+
+    if (f_handle == NULL) {
+        return false;
+    }
+
+    *crc = 0xFFFFu;
+    while ((length = fread(buffer, 1u, sizeof(buffer), f_handle)) > 0u) {
+        *crc = eeprom_crc16_update(*crc, buffer, (uint16_t)length);
+    }
+    fclose(f_handle);
+    return true;
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: fleet_calibration [options] clock_calibrations.md|chips.csv|-\n"
+            "  --firmware FILE   Firmware to program (default .pio/build/attiny85/firmware.hex)\n"
+            "  --config FILE     Eeprom image of eeprom_profile, its configuration is used for all chips\n"
+            "  --out DIR         Output folder, must exist (default .)\n"
+            "  --prefix NAME     Start of the image file names (default clock_calibration_)\n"
+            "  --bin             Raw binary images instead of Intel HEX\n"
+            "  --port PORT       Programmer port in the avrdude commands (default COM6)\n"
+            "  --force           Overwrite existing images\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    fleet_options_t options = {".pio/build/attiny85/firmware.hex", NULL, ".", "clock_calibration_", ".hex", "COM6", false};
+    const char* table_filename = NULL;
+    char line[FLEET_LINE_LENGTH];
+    char filename[FLEET_LINE_LENGTH];
+    eeprom_config_t config;
+    std::set<unsigned long> chip_ids;
+    unsigned line_number = 0u;
+    unsigned chips = 0u;
+    unsigned errors = 0u;
+    uint16_t firmware_crc = 0u;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+        const char* argument = ((arg + 1) < argc) ? argv[arg + 1] : NULL;
+
+        if (strcmp(option, "--bin") == 0) {
+            options.suffix = ".bin";
+        } else if (strcmp(option, "--force") == 0) {
+            options.force = true;
+        } else if (option[0] != '-' || option[1] == '\0') {
+            table_filename = option;
+        } else if (argument == NULL) {
+            print_usage();
+        } else {
+            arg++;
+            if (strcmp(option, "--firmware") == 0) {
+                options.firmware_filename = argument;
+            } else if (strcmp(option, "--config") == 0) {
+                options.config_filename = argument;
+            } else if (strcmp(option, "--out") == 0) {
+                options.output_directory = argument;
+            } else if (strcmp(option, "--prefix") == 0) {
+                options.prefix = argument;
+            } else if (strcmp(option, "--port") == 0) {
+                options.port = argument;
+            } else {
+                print_usage();
+            }
+        }
+    }
+    if (table_filename == NULL) {
+        print_usage();
+    }
+
+    if (!file_crc(options.firmware_filename, &firmware_crc)) {
+        fprintf(stderr, "Firmware '%s' not found, build it first (pio run -e attiny85).\n", options.firmware_filename);
+        return 1;
+    }
+
+    eeprom_config_defaults(&config);
+    if (options.config_filename != NULL) {
+        eeprom_image_t profile;
+        const char* error = NULL;
+
+        if (!eeprom_image_read(&profile, options.config_filename, &error)) {
+            fprintf(stderr, "%s: %s\n", options.config_filename, error);
+            return 1;
+        }
+        if (!eeprom_image_get_config(&profile, &config)) {
+            fprintf(stderr, "%s: no valid configuration block.\n", options.config_filename);
+            return 1;
+        }
+    }
+
+    FILE* table = (strcmp(table_filename, "-") == 0) ? stdin : fopen(table_filename, "r");
+    if (table == NULL) {
+        perror(table_filename);
+        return 1;
+    }
+    snprintf(filename, sizeof(filename), "%s/manifest.csv", options.output_directory);
+    FILE* manifest = fopen(filename, "w");
+    if (manifest == NULL) {
+        perror(filename);
+        return 1;
+    }
+    fprintf(manifest, "# firmware %s crc %04X\n", options.firmware_filename, (unsigned)firmware_crc);
+    fprintf(manifest, "chip_id,frequency_hz,deviation_percent,eeprom_image,config_crc,command\n");
+
+    while (fgets(line, sizeof(line), table) != NULL) {
+        unsigned long chip_id;
+        unsigned long frequency;
+        eeprom_image_t image;
+
+        line_number++;
+        if (!parse_row(line, &chip_id, &frequency)) {
+            continue;
+        }
+
+        if (!eeprom_image_calibration_valid((uint32_t)frequency)) {
+            fprintf(stderr, "%s:%u: chip %lu: %luHz is outside of %lu+-%luHz.\n", table_filename, line_number, chip_id,
+                    frequency, (unsigned long)SLEEP_CLOCK_VALUE_HZ, (unsigned long)SLEEP_CLOCK_DEVIATION_MAX_HZ);
+            errors++;
+            continue;
+        }
+        if (!chip_ids.insert(chip_id).second) {
+            fprintf(stderr, "%s:%u: chip %lu is listed twice.\n", table_filename, line_number, chip_id);
+            errors++;
+            continue;
+        }
+
+        // The legacy record keeps the image usable with firmware that has no configuration block.
+        config.clock_calibration = (uint32_t)frequency;
+        config.flags |= EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION;
+        config.flags &= (uint8_t)~EEPROM_CONFIG_FLAG_TWO_POINT_CALIBRATION;
+        eeprom_image_init(&image);
+        eeprom_image_set_legacy_calibration(&image, (uint32_t)frequency);
+        eeprom_image_set_config(&image, &config);
+
+        // A rerun keeps identical images, a changed image is only replaced with --force.
+        snprintf(filename, sizeof(filename), "%s/%s%03lu%s", options.output_directory, options.prefix, chip_id,
+                 options.suffix);
+        bool exists = !options.force && file_exists(filename);
+        if (exists && !image_file_matches(filename, &image)) {
+            fprintf(stderr, "%s:%u: chip %lu: '%s' exists with other content, use --force to overwrite.\n",
+                    table_filename, line_number, chip_id, filename);
+            errors++;
+            continue;
+        }
+
+        if (eeprom_image_check(&image, stderr) != 0u || (!exists && !eeprom_image_write_file(&image, filename))) {
+            fprintf(stderr, "%s:%u: chip %lu: writing '%s' failed.\n", table_filename, line_number, chip_id, filename);
+            errors++;
+            continue;
+        }
+
+        fprintf(manifest,
+                "%lu,%lu,%+.2f,%s,%04X,avrdude -c stk500v1 -P %s -b 115200 -p t85 -U flash:w:%s:i -U eeprom:w:%s:%c"
+                " -U lfuse:w:0x%02X:m -U hfuse:w:0x%02X:m -U efuse:w:0x%02X:m\n",
+                chip_id, frequency, 100.0 * ((double)frequency - SLEEP_CLOCK_VALUE_HZ) / SLEEP_CLOCK_VALUE_HZ, filename,
+                (unsigned)config.crc, options.port, options.firmware_filename, filename,
+                (strcmp(options.suffix, ".bin") == 0) ? 'r' : 'i', FLEET_FUSE_LOW, FLEET_FUSE_HIGH, FLEET_FUSE_EXTENDED);
+        chips++;
+    }
+
+    if (table != stdin) {
+        fclose(table);
+    }
+    fclose(manifest);
+
+    printf("%u chips written to '%s/manifest.csv', %u errors.\n", chips, options.output_directory, errors);
+    return (errors == 0u) ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+# Flash and RAM footprint report of the attiny85 firmware.
+#
+# Used as PlatformIO extra script (see platformio.ini), it adds two custom targets:
+#   pio run -e attiny85 -t footprint           Report the footprint and compare it with the stored baseline.
+#   pio run -e attiny85 -t footprint_baseline  Store the current footprint as new baseline.
+#
+# It can also be run directly on an elf/map pair:
+#   python tools/footprint_report.py .pio/build/attiny85/firmware.elf [--baseline tools/footprint_baseline.txt]
+#
+# The report lists every symbol with its size and section and sums up the flash/ram usage per object file,
+# e.g. the Arduino core or the libgcc 32-bit division pulled in by apply_clock_calibration().
+# The check fails if the flash or ram usage, or a single symbol, grew by more than the threshold compared to the
+# baseline (a new symbol counts with its full size), if the usage exceeds the ATtiny85 limits or if there is no baseline to compare with. A baseline is only ever
+# created explicitly, with the footprint_baseline target or --update-baseline.
+import os
+import re
+import subprocess
+import sys
+
+# ATtiny85 limits.
+flash_size_bytes = 8192
+ram_size_bytes = 512
+
+# Allowed growth compared to the baseline before the check fails.
+default_threshold_bytes = 64
+
+# Symbols smaller than this are only included in the per object totals.
+report_min_symbol_bytes = 4
+
+# nm symbol types and the memory they occupy.
+flash_symbol_types = "TtRr"
+ram_symbol_types = "BbDdVv"
+
+# Sections that occupy flash and/or ram.
+flash_sections = (".text", ".data")
+ram_sections = (".data", ".bss", ".noinit")
+
+default_baseline = os.path.join(os.path.dirname(os.path.abspath(__file__)), "footprint_baseline.txt")
+
+
+def run_tool(tool, args, tool_env=None):
+    return subprocess.run([tool] + args, check=True, stdout=subprocess.PIPE,
+                          universal_newlines=True, env=tool_env).stdout
+
+
+def read_section_sizes(size_tool, elf_path, tool_env=None):
+    sections = {}
+    for line in run_tool(size_tool, ["-A", elf_path], tool_env).splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[0].startswith(".") and fields[1].isdigit():
+            sections[fields[0]] = int(fields[1])
+    flash = sum(sections.get(name, 0) for name in flash_sections)
+    ram = sum(sections.get(name, 0) for name in ram_sections)
+    return sections, flash, ram
+
+
+def read_symbols(nm_tool, elf_path, tool_env=None):
+    symbols = []
+    output = run_tool(nm_tool, ["--size-sort", "-S", "-C", "--defined-only", elf_path], tool_env)
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) != 4:
+            continue
+        size = int(fields[1], 16)
+        memory = "flash" if fields[2] in flash_symbol_types else "ram" if fields[2] in ram_symbol_types else "other"
+        symbols.append((fields[3], size, memory))
+    return symbols
+
+
+# GNU ld map: input section lines ' .text.name  0x00000123  0x42 path/to/lib.a(object.o)',
+# long section names wrap the address onto the next line.
+map_input_section = re.compile(r"^ (\.\S+)?\s+0x[0-9a-f]+\s+0x([0-9a-f]+)\s+(\S+)$")
+
+
+def read_object_sizes(map_path):
+    objects = {}
+    if not os.path.exists(map_path):
+        return objects
+
+    in_memory_map = False
+    pending_section = None
+    with open(map_path, "r") as f_handle:
+        for line in f_handle:
+            line = line.rstrip("\n")
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+                continue
+            if not in_memory_map:
+                continue
+
+            if re.match(r"^ \.\S+$", line):
+                pending_section = line.strip()
+                continue
+
+            match = map_input_section.match(line)
+            if match is None:
+                pending_section = None
+                continue
+
+            section = match.group(1) or pending_section or ""
+            pending_section = None
+            size = int(match.group(2), 16)
+            if size == 0 or not section.startswith((".text", ".data", ".bss", ".progmem", ".rodata")):
+                continue
+
+            origin = os.path.basename(match.group(3))
+            flash, ram = objects.get(origin, (0, 0))
+            if section.startswith(".bss"):
+                ram += size
+            elif section.startswith(".data"):
+                flash += size
+                ram += size
+            else:
+                flash += size
+            objects[origin] = (flash, ram)
+    return objects
+
+
+def read_baseline(baseline_path):
+    baseline = {}
+    if not os.path.exists(baseline_path):
+        return None
+    with open(baseline_path, "r") as f_handle:
+        for line in f_handle:
+            fields = line.split()
+            if len(fields) == 2 and not line.startswith("#"):
+                baseline[fields[0]] = int(fields[1])
+    return baseline
+
+
+def write_baseline(baseline_path, flash, ram, symbols):
+    with open(baseline_path, "w") as f_handle:
+        f_handle.write("# Footprint baseline, generated by tools/footprint_report.py.\n")
+        f_handle.write(f"@flash {flash}\n@ram {ram}\n")
+        for name, size, memory in sorted(symbols):
+            if memory != "other" and " " not in name:
+                f_handle.write(f"{name} {size}\n")
+    print(f"Footprint baseline written to '{baseline_path}'.")
+
+
+def report(elf_path, map_path, baseline_path, threshold_bytes, size_tool="avr-size", nm_tool="avr-nm",
+           update_baseline=False, tool_env=None):
+    sections, flash, ram = read_section_sizes(size_tool, elf_path, tool_env)
+    symbols = read_symbols(nm_tool, elf_path, tool_env)
+
+    if update_baseline:
+        write_baseline(baseline_path, flash, ram, symbols)
+        return 0
+
+    baseline = read_baseline(baseline_path)
+
+    print("Sections:")
+    for name, size in sorted(sections.items()):
+        if name in flash_sections or name in ram_sections:
+            print(f"  {name:<24} {size:>6} B")
+
+    objects = read_object_sizes(map_path)
+    if objects:
+        print("Objects (flash/ram):")
+        for origin, (obj_flash, obj_ram) in sorted(objects.items(), key=lambda item: -item[1][0] - item[1][1]):
+            print(f"  {origin:<48} {obj_flash:>6} B {obj_ram:>5} B")
+
+    print("Symbols:")
+    for name, size, memory in sorted(symbols, key=lambda symbol: -symbol[1]):
+        if size < report_min_symbol_bytes or memory == "other":
+            continue
+        delta = ""
+        if baseline is not None and name in baseline and baseline[name] != size:
+            delta = f" ({size - baseline[name]:+d})"
+        print(f"  {memory:<5} {size:>6} B {name}{delta}")
+
+    print(f"Flash: {flash:>5} / {flash_size_bytes} B ({100.0 * flash / flash_size_bytes:.1f}%)")
+    print(f"RAM:   {ram:>5} / {ram_size_bytes} B ({100.0 * ram / ram_size_bytes:.1f}%), "
+          f"{ram_size_bytes - ram} B left for the stack")
+
+    failed = False
+    if flash > flash_size_bytes or ram > ram_size_bytes:
+        print("Footprint exceeds the ATtiny85 limits.")
+        failed = True
+
+    if baseline is None:
+        print(f"No baseline found at '{baseline_path}', create one with the 'footprint_baseline' target "
+              f"or --update-baseline.")
+        failed = True
+    else:
+        for name, current in (("flash", flash), ("ram", ram)):
+            growth = current - baseline.get("@" + name, current)
+            print(f"{name.capitalize()} growth against the baseline: {growth:+d} B (threshold {threshold_bytes} B)")
+            if growth > threshold_bytes:
+                failed = True
+
+        # Symbols that are stored in the baseline, a new one grew from zero.
+        for name, size, memory in sorted(symbols):
+            if memory == "other" or " " in name:
+                continue
+            growth = size - baseline.get(name, 0)
+            if growth > threshold_bytes:
+                print(f"Symbol {name} grew by {growth:+d} B against the baseline (threshold {threshold_bytes} B)")
+                failed = True
+
+    return 1 if failed else 0
+
+
+def register_platformio_targets(env):
+    build_elf = os.path.join(env.subst("$BUILD_DIR"), env.subst("${PROGNAME}.elf"))
+    build_map = os.path.join(env.subst("$BUILD_DIR"), env.subst("${PROGNAME}.map"))
+    env.Append(LINKFLAGS=["-Wl,-Map," + build_map])
+
+    threshold_bytes = int(env.GetProjectOption("custom_footprint_threshold", default_threshold_bytes))
+    baseline_path = env.GetProjectOption("custom_footprint_baseline", default_baseline)
+    if not os.path.isabs(baseline_path):
+        baseline_path = os.path.join(env.subst("$PROJECT_DIR"), baseline_path)
+    tool_dir = os.path.dirname(env.subst("$CC")) if os.path.dirname(env.subst("$CC")) else ""
+
+    def run_report(update_baseline):
+        def action(*args, **kwargs):
+            result = report(build_elf, build_map, baseline_path, threshold_bytes,
+                            size_tool=os.path.join(tool_dir, "avr-size"), nm_tool=os.path.join(tool_dir, "avr-nm"),
+                            update_baseline=update_baseline, tool_env=env["ENV"])
+            if result != 0:
+                env.Exit(result)
+        return action
+
+    env.AddCustomTarget("footprint", build_elf, run_report(False),
+                        title="Footprint", description="Report flash/ram usage and compare with the baseline")
+    env.AddCustomTarget("footprint_baseline", build_elf, run_report(True),
+                        title="Footprint Baseline", description="Store the current flash/ram usage as baseline")
+
+
+def main():
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Flash and RAM footprint report of the attiny85 firmware.")
+    parser.add_argument("elf", help="The firmware elf file.")
+    parser.add_argument("--map", help="The linker map file (default: elf with .map extension).")
+    parser.add_argument("--baseline", default=default_baseline, help="The baseline file.")
+    parser.add_argument("--threshold", type=int, default=default_threshold_bytes, help="Allowed growth in bytes.")
+    parser.add_argument("--update-baseline", action="store_true", help="Store the current footprint as baseline.")
+    parser.add_argument("--size", default="avr-size", help="The size tool.")
+    parser.add_argument("--nm", default="avr-nm", help="The nm tool.")
+    args = parser.parse_args()
+
+    map_path = args.map or os.path.splitext(args.elf)[0] + ".map"
+    sys.exit(report(args.elf, map_path, args.baseline, args.threshold, args.size, args.nm, args.update_baseline))
+
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO when used as extra script.
+    register_platformio_targets(env)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        main()
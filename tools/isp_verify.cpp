@@ -0,0 +1,432 @@
+/// @file isp_verify.cpp
+/// Host tool: verify the memory of the target without reading it back. The ArduinoISP reads the range over SPI and
+/// answers only its CRC32 (vendor command 'C' of `arduino_as_isp/src/main.cpp`), the tool compares it with the CRC32
+/// of the image. The serial line carries 4 bytes instead of the whole memory, the SPI reads stay the same.
+///
+/// The image is Intel HEX or raw binary, the range starts at 0 and ends with the last byte of the image (flash: rounded
+/// up to a word). Gaps of an Intel HEX image count as erased (0xFF). Without `--port` only the CRC32 of the image is
+/// printed, e.g. to store it next to a release.
+///
+/// With `--blank-pages` the tool first reports the blank flash pages the programmer skipped during the last
+/// programming (e.g. by avrdude) and the write time that saved, from the vendor parameters 0x8A..0x8D. They are reset
+/// when a programming mode is entered, so they are read before the verification.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -Iarduino_as_isp/include -o isp_verify tools/isp_verify.cpp
+/// Usage: isp_verify [--port PORT] [--baud N] [--eeprom] [--size N] image.hex|image.bin
+///        isp_verify --port PORT [--baud N] --blank-pages [image.hex|image.bin]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc32.h"
+#include "flash_image.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/// The biggest range of one 'C' command (16 bit length).
+#define VERIFY_SIZE_MAX FLASH_IMAGE_SIZE_MAX
+
+/// The time to wait for the CRC per byte of the range: one 32 bit SPI transaction at the slowest clock of the
+/// ArduinoISP (SPI_CLOCK_MIN, ~4kHz) with margin, plus the fixed part.
+#define VERIFY_TIMEOUT_MS_PER_BYTE 10u
+#define VERIFY_TIMEOUT_MS 2000u
+
+/// Opening the port resets an Arduino without a capacitor on its reset line, the bootloader takes ~1.5s.
+#define VERIFY_SYNC_ATTEMPTS 12u
+#define VERIFY_SYNC_TIMEOUT_MS 250u
+#define VERIFY_REPLY_TIMEOUT_MS 500u
+
+// STK500v1, see arduino_as_isp/src/main.cpp
+#define STK_GET_SYNC 0x30u
+#define STK_ENTER_PROGMODE 0x50u
+#define STK_LEAVE_PROGMODE 0x51u
+#define STK_LOAD_ADDRESS 0x55u
+#define STK_READ_SIGN 0x75u
+#define STK_CRC_PAGE 0x43u
+#define STK_GET_PARAMETER 0x41u
+#define STK_OK 0x10u
+#define STK_INSYNC 0x14u
+#define CRC_EOP 0x20u
+
+// Vendor parameters of the ArduinoISP: blank flash pages skipped, time saved in ms (low byte first)
+#define PARAM_BLANK_PAGES_LOW 0x8Au
+#define PARAM_SAVED_MS_LOW 0x8Cu
+
+/// The settings of a run.
+typedef struct verify_options {
+    const char* port;
+    unsigned long baud;
+    bool eeprom;
+    unsigned long size;
+    bool blank_pages;
+} verify_options_t;
+
+#ifdef _WIN32
+typedef HANDLE serial_port_t;
+#define SERIAL_PORT_INVALID INVALID_HANDLE_VALUE
+#else
+typedef int serial_port_t;
+#define SERIAL_PORT_INVALID (-1)
+#endif
+
+/// Open the programmer port: 8N1, raw.
+///
+/// @param name The port, e.g. COM6 or /dev/ttyACM0.
+/// @param baud The baud rate.
+/// @return The port, @ref SERIAL_PORT_INVALID on failure.
+static serial_port_t serial_open(const char* name, unsigned long baud) {
+#ifdef _WIN32
+    char path[64];
+    DCB dcb;
+
+    snprintf(path, sizeof(path), "\\\\.\\%s", name);
+    HANDLE port = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (port == INVALID_HANDLE_VALUE) {
+        return SERIAL_PORT_INVALID;
+    }
+    memset(&dcb, 0, sizeof(dcb));
+    dcb.DCBlength = sizeof(dcb);
+    if (!GetCommState(port, &dcb)) {
+        CloseHandle(port);
+        return SERIAL_PORT_INVALID;
+    }
+    dcb.BaudRate = (DWORD)baud;
+    dcb.ByteSize = 8;
+    dcb.Parity = NOPARITY;
+    dcb.StopBits = ONESTOPBIT;
+    dcb.fBinary = TRUE;
+    dcb.fDtrControl = DTR_CONTROL_ENABLE;
+    dcb.fRtsControl = RTS_CONTROL_ENABLE;
+    dcb.fOutxCtsFlow = FALSE;
+    dcb.fOutxDsrFlow = FALSE;
+    dcb.fOutX = FALSE;
+    dcb.fInX = FALSE;
+    if (!SetCommState(port, &dcb)) {
+        CloseHandle(port);
+        return SERIAL_PORT_INVALID;
+    }
+    return port;
+#else
+    struct termios settings;
+    speed_t speed;
+
+    switch (baud) {
+    case 19200u:
+        speed = B19200;
+        break;
+    case 57600u:
+        speed = B57600;
+        break;
+    case 115200u:
+        speed = B115200;
+        break;
+    default:
+        return SERIAL_PORT_INVALID;
+    }
+
+    int port = open(name, O_RDWR | O_NOCTTY);
+    if (port < 0) {
+        return SERIAL_PORT_INVALID;
+    }
+    if (tcgetattr(port, &settings) != 0) {
+        close(port);
+        return SERIAL_PORT_INVALID;
+    }
+    cfmakeraw(&settings);
+    cfsetispeed(&settings, speed);
+    cfsetospeed(&settings, speed);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = 0;
+    if (tcsetattr(port, TCSANOW, &settings) != 0) {
+        close(port);
+        return SERIAL_PORT_INVALID;
+    }
+    return port;
+#endif
+}
+
+static void serial_close(serial_port_t port) {
+#ifdef _WIN32
+    CloseHandle(port);
+#else
+    close(port);
+#endif
+}
+
+/// Drop everything received so far.
+static void serial_flush(serial_port_t port) {
+#ifdef _WIN32
+    PurgeComm(port, PURGE_RXCLEAR);
+#else
+    tcflush(port, TCIFLUSH);
+#endif
+}
+
+static bool serial_write(serial_port_t port, const uint8_t* data, unsigned length) {
+#ifdef _WIN32
+    DWORD written = 0;
+    return WriteFile(port, data, length, &written, NULL) && written == length;
+#else
+    while (length > 0u) {
+        ssize_t written = write(port, data, length);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= (unsigned)written;
+    }
+    return true;
+#endif
+}
+
+/// Read an exact amount of bytes.
+///
+/// @param port The port.
+/// @param data The received bytes.
+/// @param length The amount of bytes.
+/// @param timeout_ms The time for all bytes.
+/// @return False on a timeout.
+static bool serial_read(serial_port_t port, uint8_t* data, unsigned length, unsigned long timeout_ms) {
+#ifdef _WIN32
+    COMMTIMEOUTS timeouts;
+    DWORD received = 0;
+
+    memset(&timeouts, 0, sizeof(timeouts));
+    timeouts.ReadTotalTimeoutConstant = (DWORD)timeout_ms;
+    SetCommTimeouts(port, &timeouts);
+    return ReadFile(port, data, length, &received, NULL) && received == length;
+#else
+    struct timespec start;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (length > 0u) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L;
+        struct pollfd readable = {port, POLLIN, 0};
+
+        if (elapsed_ms >= (long)timeout_ms || poll(&readable, 1u, (int)(timeout_ms - elapsed_ms)) <= 0) {
+            return false;
+        }
+        ssize_t received = read(port, data, length);
+        if (received < 0) {
+            return false;
+        }
+        data += received;
+        length -= (unsigned)received;
+    }
+    return true;
+#endif
+}
+
+/// Send a command and check its answer: STK_INSYNC, the data, STK_OK.
+///
+/// @param port The port.
+/// @param command The command including CRC_EOP.
+/// @param command_length The size of the command.
+/// @param data The data of the answer.
+/// @param data_length The size of the data.
+/// @param timeout_ms The time for the answer.
+/// @return False on a timeout or a failed command.
+static bool stk_command(serial_port_t port, const uint8_t* command, unsigned command_length, uint8_t* data,
+                        unsigned data_length, unsigned long timeout_ms) {
+    uint8_t status;
+
+    if (!serial_write(port, command, command_length) || !serial_read(port, &status, 1u, timeout_ms) ||
+        status != STK_INSYNC) {
+        return false;
+    }
+    return serial_read(port, data, data_length, timeout_ms) && serial_read(port, &status, 1u, timeout_ms) &&
+           status == STK_OK;
+}
+
+/// Get in sync with the programmer, it may still be in its bootloader after the reset by opening the port.
+static bool stk_sync(serial_port_t port) {
+    static const uint8_t command[] = {STK_GET_SYNC, CRC_EOP};
+
+    for (uint8_t attempt = 0u; attempt < VERIFY_SYNC_ATTEMPTS; attempt++) {
+        serial_flush(port);
+        if (stk_command(port, command, sizeof(command), NULL, 0u, VERIFY_SYNC_TIMEOUT_MS)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Read a 16 bit vendor parameter of the programmer.
+///
+/// @param port The port, the programmer is in sync.
+/// @param parameter The parameter of the low byte, the high byte follows.
+/// @param value The value.
+/// @return False if the programmer doesn't answer.
+static bool stk_parameter16(serial_port_t port, uint8_t parameter, unsigned* value) {
+    uint8_t low;
+    uint8_t high;
+    const uint8_t get_low[] = {STK_GET_PARAMETER, parameter, CRC_EOP};
+    const uint8_t get_high[] = {STK_GET_PARAMETER, (uint8_t)(parameter + 1u), CRC_EOP};
+
+    if (!stk_command(port, get_low, sizeof(get_low), &low, 1u, VERIFY_REPLY_TIMEOUT_MS) ||
+        !stk_command(port, get_high, sizeof(get_high), &high, 1u, VERIFY_REPLY_TIMEOUT_MS)) {
+        return false;
+    }
+    *value = ((unsigned)high << 8u) | low;
+    return true;
+}
+
+/// Let the programmer calculate the crc of the range.
+///
+/// @param port The port, the programmer is in sync.
+/// @param options The range.
+/// @param signature The signature of the target.
+/// @param crc The crc of the range.
+/// @return The failed step, NULL on success.
+static const char* programmer_crc(serial_port_t port, const verify_options_t* options, uint8_t signature[3],
+                                  uint32_t* crc) {
+    static const uint8_t enter[] = {STK_ENTER_PROGMODE, CRC_EOP};
+    static const uint8_t read_sign[] = {STK_READ_SIGN, CRC_EOP};
+    static const uint8_t load_address[] = {STK_LOAD_ADDRESS, 0u, 0u, CRC_EOP};
+    static const uint8_t leave[] = {STK_LEAVE_PROGMODE, CRC_EOP};
+    const uint8_t crc_page[] = {STK_CRC_PAGE, (uint8_t)(options->size >> 8u), (uint8_t)options->size,
+                                (uint8_t)(options->eeprom ? 'E' : 'F'), CRC_EOP};
+    uint8_t answer[4];
+    const char* error = NULL;
+
+    if (!stk_command(port, enter, sizeof(enter), NULL, 0u, VERIFY_REPLY_TIMEOUT_MS)) {
+        return "entering programming mode";
+    }
+    if (!stk_command(port, read_sign, sizeof(read_sign), signature, 3u, VERIFY_REPLY_TIMEOUT_MS)) {
+        error = "reading the signature";
+    } else if (!stk_command(port, load_address, sizeof(load_address), NULL, 0u, VERIFY_REPLY_TIMEOUT_MS)) {
+        error = "loading the address";
+    } else if (!stk_command(port, crc_page, sizeof(crc_page), answer, 4u,
+                            VERIFY_TIMEOUT_MS + VERIFY_TIMEOUT_MS_PER_BYTE * options->size)) {
+        error = "CRC command (programmer without isp_verify support?)";
+    } else {
+        *crc = ((uint32_t)answer[0] << 24u) | ((uint32_t)answer[1] << 16u) | ((uint32_t)answer[2] << 8u) | answer[3];
+    }
+
+    // Release the target also after a failure.
+    stk_command(port, leave, sizeof(leave), NULL, 0u, VERIFY_REPLY_TIMEOUT_MS);
+    return error;
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: isp_verify [options] image.hex|image.bin\n"
+            "  --port PORT   Programmer port, without it only the CRC32 of the image is printed\n"
+            "  --baud N      Baud rate of the programmer (default 115200)\n"
+            "  --eeprom      Verify the eeprom (default flash)\n"
+            "  --size N      Size of the range in bytes (default end of the image)\n"
+            "  --blank-pages Report the blank flash pages skipped by the last programming, the image is optional\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    static flash_image_t image;
+    verify_options_t options = {NULL, 115200u, false, 0u, false};
+    const char* image_filename = NULL;
+    const char* error = NULL;
+    uint8_t signature[3];
+    uint32_t target_crc = 0u;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+        const char* argument = ((arg + 1) < argc) ? argv[arg + 1] : NULL;
+
+        if (strcmp(option, "--eeprom") == 0) {
+            options.eeprom = true;
+        } else if (strcmp(option, "--blank-pages") == 0) {
+            options.blank_pages = true;
+        } else if (option[0] != '-') {
+            image_filename = option;
+        } else if (argument == NULL) {
+            print_usage();
+        } else {
+            arg++;
+            if (strcmp(option, "--port") == 0) {
+                options.port = argument;
+            } else if (strcmp(option, "--baud") == 0) {
+                options.baud = strtoul(argument, NULL, 0);
+            } else if (strcmp(option, "--size") == 0) {
+                options.size = strtoul(argument, NULL, 0);
+            } else {
+                print_usage();
+            }
+        }
+    }
+    if ((image_filename == NULL && !options.blank_pages) || (options.blank_pages && options.port == NULL) ||
+        options.size > VERIFY_SIZE_MAX) {
+        print_usage();
+    }
+
+    uint32_t image_crc = 0u;
+    if (image_filename != NULL) {
+        if (!flash_image_read(&image, image_filename, &error)) {
+            fprintf(stderr, "%s: %s\n", image_filename, error);
+            return 2;
+        }
+        if (options.size == 0u) {
+            // Flash is read in words.
+            options.size = options.eeprom ? image.size : ((image.size + 1u) & ~1ul);
+        }
+        if (options.size == 0u || options.size > VERIFY_SIZE_MAX) {
+            fprintf(stderr, "%s: no data to verify.\n", image_filename);
+            return 2;
+        }
+
+        image_crc = ~crc32_update(CRC32_INITIAL, image.data, (uint16_t)options.size);
+        printf("Image:   %s, %s 0x0000..0x%04lX, CRC32 %08lX\n", image_filename, options.eeprom ? "eeprom" : "flash",
+               options.size - 1u, (unsigned long)image_crc);
+        if (options.port == NULL) {
+            return 0;
+        }
+    }
+
+    serial_port_t port = serial_open(options.port, options.baud);
+    if (port == SERIAL_PORT_INVALID) {
+        fprintf(stderr, "%s: can't open the port at %lu baud.\n", options.port, options.baud);
+        return 2;
+    }
+    if (!stk_sync(port)) {
+        fprintf(stderr, "%s: no answer from the programmer.\n", options.port);
+        serial_close(port);
+        return 2;
+    }
+
+    // Before the verification, entering the programming mode resets the counters.
+    if (options.blank_pages) {
+        unsigned blank_pages;
+        unsigned saved_ms;
+        if (!stk_parameter16(port, PARAM_BLANK_PAGES_LOW, &blank_pages) || !stk_parameter16(port, PARAM_SAVED_MS_LOW, &saved_ms)) {
+            fprintf(stderr, "%s: failed at reading the blank pages.\n", options.port);
+            serial_close(port);
+            return 2;
+        }
+        printf("Blank:   %u flash pages skipped by the last programming, %ums of page writes saved\n", blank_pages, saved_ms);
+        if (image_filename == NULL) {
+            serial_close(port);
+            return 0;
+        }
+    }
+
+    error = programmer_crc(port, &options, signature, &target_crc);
+    serial_close(port);
+    if (error != NULL) {
+        fprintf(stderr, "%s: failed at %s.\n", options.port, error);
+        return 2;
+    }
+
+    printf("Target:  signature %02X %02X %02X, CRC32 %08lX\n", signature[0], signature[1], signature[2],
+           (unsigned long)target_crc);
+    printf("%s\n", (target_crc == image_crc) ? "Verified." : "MISMATCH, program the target again.");
+    return (target_crc == image_crc) ? 0 : 1;
+}
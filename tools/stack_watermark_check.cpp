@@ -0,0 +1,204 @@
+/// @file stack_watermark_check.cpp
+/// Host tool: run the stack watermark of `include/stack_watermark.h` over painted buffers. A buffer stands for the ram
+/// of the ATtiny85 with guard bytes on both sides, random static variables at the bottom and a stack of random depth at
+/// the top. Checks that the paint covers exactly the free ram, that the scan reports the untouched bytes and that only
+/// a smaller headroom is stored. Exits with 1 on a violation.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o stack_watermark_check tools/stack_watermark_check.cpp
+/// Usage: stack_watermark_check [--seed N] [--runs N]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stack_watermark.h"
+
+/// The ram of the ATtiny85.
+#define CHECK_RAM_SIZE 512u
+
+/// Bytes around the ram that must never be painted.
+#define CHECK_GUARD_SIZE 16u
+
+/// The value of the guard bytes.
+#define CHECK_GUARD 0x5Au
+
+/// Stack depths scanned per run, like the wakeups of a device.
+#define CHECK_WAKEUPS 64u
+
+/// Violations found so far.
+static unsigned long violations;
+
+/// State of the xorshift32 generator.
+static uint32_t prng_state;
+
+/// Next pseudo random number.
+///
+/// @return The number.
+static uint32_t prng_next(void) {
+    prng_state ^= prng_state << 13u;
+    prng_state ^= prng_state >> 17u;
+    prng_state ^= prng_state << 5u;
+    return prng_state;
+}
+
+/// Pseudo random number in a range.
+///
+/// @param min The smallest number.
+/// @param max The largest number.
+/// @return The number.
+static uint32_t prng_range(uint32_t min, uint32_t max) {
+    return min + (prng_next() % (max - min + 1u));
+}
+
+/// Report a violation.
+///
+/// @param seed The seed of the run.
+/// @param run The run.
+/// @param what The violated invariant.
+/// @param actual The value found.
+/// @param expected The value expected.
+static void report(uint32_t seed, unsigned long run, const char* what, unsigned long actual, unsigned long expected) {
+    if (violations < 20u) {
+        fprintf(stderr, "seed %lu run %lu: %s (%lu, expected %lu)\n", (unsigned long)seed, run, what, actual, expected);
+    }
+    violations++;
+}
+
+/// The headroom of a stack: the bytes below the deepest byte written, plus the written bytes at the bottom of the
+/// stack that happen to hold the canary (the scan can't tell them apart).
+///
+/// @param stack The deepest byte written by the stack.
+/// @param bottom The first byte after the static variables.
+/// @param top The top of the ram.
+/// @return The expected headroom.
+static uint16_t expected_headroom(const uint8_t* stack, const uint8_t* bottom, const uint8_t* top) {
+    uint16_t headroom = (uint16_t)(stack - bottom);
+
+    while (stack <= top && *stack == STACK_CANARY) {
+        stack++;
+        headroom++;
+    }
+    return headroom;
+}
+
+/// One device: paint, then let the stack grow to random depths and track the smallest headroom like `main.cpp`.
+///
+/// @param seed The seed of the run.
+/// @param run The run.
+static void check_run(uint32_t seed, unsigned long run) {
+    static uint8_t memory[CHECK_GUARD_SIZE + CHECK_RAM_SIZE + CHECK_GUARD_SIZE];
+    uint8_t* ram = &memory[CHECK_GUARD_SIZE];
+    uint16_t statics = (uint16_t)prng_range(0u, CHECK_RAM_SIZE - 1u);
+    uint8_t* bottom = &ram[statics];
+    uint8_t* top = &ram[CHECK_RAM_SIZE - 1u];
+    uint16_t free_ram = (uint16_t)(CHECK_RAM_SIZE - statics);
+    uint16_t headroom_min = UINT16_MAX;
+    uint16_t stored = UINT16_MAX;
+    uint16_t depth_max = 0u;
+
+    memset(memory, CHECK_GUARD, sizeof(memory));
+    for (uint16_t index = 0u; index < statics; index++) {
+        ram[index] = (uint8_t)prng_next();
+    }
+    stack_watermark_paint(bottom, top);
+
+    for (unsigned index = 0u; index < CHECK_GUARD_SIZE; index++) {
+        if (memory[index] != CHECK_GUARD || memory[CHECK_GUARD_SIZE + CHECK_RAM_SIZE + index] != CHECK_GUARD) {
+            report(seed, run, "paint outside of the ram", index, 0u);
+            break;
+        }
+    }
+    for (uint8_t* p = bottom; p <= top; p++) {
+        if (*p != STACK_CANARY) {
+            report(seed, run, "free byte not painted", (unsigned long)(p - ram), statics);
+            break;
+        }
+    }
+    if (stack_watermark_headroom(bottom, top) != free_ram) {
+        report(seed, run, "headroom of an unused stack", stack_watermark_headroom(bottom, top), free_ram);
+    }
+
+    for (unsigned wakeup = 0u; wakeup < CHECK_WAKEUPS; wakeup++) {
+        // Mostly shallow stacks, now and then one that fills the free ram.
+        uint16_t depth = (prng_range(0u, 7u) == 0u) ? (uint16_t)prng_range(0u, free_ram)
+                                                     : (uint16_t)prng_range(0u, (free_ram < 32u) ? free_ram : 32u);
+
+        // A used stack byte may hold any value, also the canary.
+        for (uint16_t index = 0u; index < depth; index++) {
+            top[-(int)index] = (prng_range(0u, 15u) == 0u) ? STACK_CANARY : (uint8_t)prng_next();
+        }
+        if (depth > depth_max) {
+            depth_max = depth;
+        }
+
+        uint16_t headroom = stack_watermark_headroom(bottom, top);
+        uint16_t expected = expected_headroom(top + 1 - depth_max, bottom, top);
+        if (headroom != expected) {
+            report(seed, run, "headroom", headroom, expected);
+        }
+        if (headroom > free_ram) {
+            report(seed, run, "headroom beyond the free ram", headroom, free_ram);
+        }
+
+        uint16_t previous = headroom_min;
+        if (stack_watermark_update(&headroom_min, headroom)) {
+            if (headroom >= previous) {
+                report(seed, run, "stored a headroom that didn't decrease", headroom, previous);
+            }
+            stored = headroom;
+        } else if (headroom < previous) {
+            report(seed, run, "smaller headroom not stored", headroom, previous);
+        }
+        if (headroom_min != stored || headroom_min > headroom) {
+            report(seed, run, "smallest headroom", headroom_min, stored);
+        }
+    }
+
+    if (memory[CHECK_GUARD_SIZE - 1u] != CHECK_GUARD) {
+        report(seed, run, "scan wrote below the ram", memory[CHECK_GUARD_SIZE - 1u], CHECK_GUARD);
+    }
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: stack_watermark_check [options]\n"
+            "  --seed N   Seed of the generator, 0: from the time (default 1)\n"
+            "  --runs N   Amount of devices to simulate (default 5000)\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = 1u;
+    unsigned long runs = 5000u;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+
+        if ((arg + 1) >= argc) {
+            print_usage();
+        }
+
+        const char* argument = argv[++arg];
+        if (strcmp(option, "--seed") == 0) {
+            seed = (uint32_t)strtoul(argument, NULL, 0);
+        } else if (strcmp(option, "--runs") == 0) {
+            runs = strtoul(argument, NULL, 0);
+        } else {
+            print_usage();
+        }
+    }
+
+    // xorshift32 gets stuck at 0.
+    if (seed == 0u) {
+        seed = (uint32_t)time(NULL) | 1u;
+    }
+    prng_state = seed;
+
+    for (unsigned long run = 0u; run < runs; run++) {
+        check_run(seed, run);
+    }
+
+    printf("seed %lu: %lu runs, %lu violations.\n", (unsigned long)seed, runs, violations);
+    return (violations == 0u) ? 0 : 1;
+}
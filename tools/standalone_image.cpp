@@ -0,0 +1,200 @@
+/// @file standalone_image.cpp
+/// Host tool: embed the firmware, an eeprom image and the fuses into the standalone ArduinoISP. Writes the header
+/// `arduino_as_isp/include/standalone_image.h` that `pio run -e uno_standalone` (in `arduino_as_isp`) builds into the
+/// flash of the programmer, which then programs boards without a PC (see `standalone()` in `arduino_as_isp/src/main.cpp`).
+///
+/// The eeprom image is the same for all boards: use a configuration of eeprom_profile without `--calibration`. The
+/// per chip clock calibration (legacy record of fleet_calibration) survives the chip erase thanks to the EESAVE fuse
+/// and is used by the firmware as long as the configuration block has no calibration of its own. The tool warns about
+/// an image with a calibration, it would replace the one of every board, and about fuses without EESAVE.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -Iarduino_as_isp/include -o standalone_image tools/standalone_image.cpp
+/// Usage: standalone_image [--firmware firmware.hex] [--eeprom profile.hex] [--fuses L,H,E] [--out FILE]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc32.h"
+#include "flash_image.h"
+
+/// The target, an ATtiny85.
+#define STANDALONE_SIGNATURE_0 0x1Eu
+#define STANDALONE_SIGNATURE_1 0x93u
+#define STANDALONE_SIGNATURE_2 0x0Bu
+#define STANDALONE_FLASH_SIZE 8192u
+#define STANDALONE_FLASH_PAGE_SIZE 64u
+#define STANDALONE_EEPROM_PAGE_SIZE 4u
+
+/// The regular fuses of the firmware, see `main.cpp` and `fleet_calibration.cpp`.
+#define STANDALONE_FUSE_LOW 0x62u
+#define STANDALONE_FUSE_HIGH 0xD7u
+#define STANDALONE_FUSE_EXTENDED 0xFFu
+
+/// EESAVE of the high fuse, programmed (0): the chip erase keeps the eeprom.
+#define STANDALONE_FUSE_HIGH_EESAVE 0x08u
+
+/// The longest eeprom block of the header, the length is one byte.
+#define STANDALONE_EEPROM_BLOCK_MAX 255u
+
+/// The settings of a run.
+typedef struct standalone_options {
+    const char* firmware_filename;
+    const char* eeprom_filename;
+    const char* output_filename;
+    int fuses[3];
+} standalone_options_t;
+
+/// Write bytes as the lines of a C array.
+///
+/// @param f_handle The header.
+/// @param data The bytes.
+/// @param length The amount of bytes.
+static void write_bytes(FILE* f_handle, const uint8_t* data, unsigned length) {
+    for (unsigned index = 0u; index < length; index++) {
+        fprintf(f_handle, "%s0x%02X,%s", ((index % 16u) == 0u) ? "    " : "", (unsigned)data[index],
+                ((index % 16u) == 15u || (index + 1u) == length) ? "\n" : " ");
+    }
+}
+
+/// Write the eeprom blocks: address (MSB first), length and data of every run of used bytes, a length of 0 ends them.
+///
+/// @param f_handle The header.
+/// @param image The eeprom image, NULL if there is none.
+/// @return The amount of eeprom bytes.
+static unsigned write_eeprom_blocks(FILE* f_handle, const eeprom_image_t* image) {
+    unsigned used = 0u;
+    uint16_t address = 0u;
+
+    while (image != NULL && address < EEPROM_SIZE_BYTES) {
+        uint8_t header[3];
+        uint16_t length = 0u;
+
+        if (!image->used[address]) {
+            address++;
+            continue;
+        }
+        while (address + length < EEPROM_SIZE_BYTES && image->used[address + length] && length < STANDALONE_EEPROM_BLOCK_MAX) {
+            length++;
+        }
+        header[0] = (uint8_t)(address >> 8u);
+        header[1] = (uint8_t)address;
+        header[2] = (uint8_t)length;
+        write_bytes(f_handle, header, sizeof(header));
+        write_bytes(f_handle, &image->data[address], length);
+        used += length;
+        address = (uint16_t)(address + length);
+    }
+    fprintf(f_handle, "    0x00, 0x00, 0x00,\n");
+    return used;
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: standalone_image [options]\n"
+            "  --firmware FILE   Firmware to embed (default .pio/build/attiny85/firmware.hex)\n"
+            "  --eeprom FILE     Eeprom image to embed, e.g. of eeprom_profile (default none)\n"
+            "  --fuses L,H,E     Fuses to program (default 0x62,0xD7,0xFF)\n"
+            "  --out FILE        Header to write (default arduino_as_isp/include/standalone_image.h)\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    standalone_options_t options = {".pio/build/attiny85/firmware.hex", NULL, "arduino_as_isp/include/standalone_image.h",
+                                    {STANDALONE_FUSE_LOW, STANDALONE_FUSE_HIGH, STANDALONE_FUSE_EXTENDED}};
+    static flash_image_t firmware;
+    eeprom_image_t eeprom;
+    const char* error = NULL;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+
+        if ((arg + 1) >= argc) {
+            print_usage();
+        }
+
+        const char* argument = argv[++arg];
+        if (strcmp(option, "--firmware") == 0) {
+            options.firmware_filename = argument;
+        } else if (strcmp(option, "--eeprom") == 0) {
+            options.eeprom_filename = argument;
+        } else if (strcmp(option, "--out") == 0) {
+            options.output_filename = argument;
+        } else if (strcmp(option, "--fuses") == 0) {
+            if (sscanf(argument, "%i,%i,%i", &options.fuses[0], &options.fuses[1], &options.fuses[2]) != 3 ||
+                (unsigned)options.fuses[0] > 0xFFu || (unsigned)options.fuses[1] > 0xFFu ||
+                (unsigned)options.fuses[2] > 0xFFu) {
+                print_usage();
+            }
+        } else {
+            print_usage();
+        }
+    }
+
+    if (!flash_image_read(&firmware, options.firmware_filename, &error)) {
+        fprintf(stderr, "%s: %s\n", options.firmware_filename, error);
+        return 1;
+    }
+    if (firmware.size == 0u || firmware.size > STANDALONE_FLASH_SIZE) {
+        fprintf(stderr, "%s: %lu bytes don't fit into the %u bytes of flash.\n", options.firmware_filename, firmware.size,
+                STANDALONE_FLASH_SIZE);
+        return 1;
+    }
+    // Whole pages, the rest of the last one stays erased.
+    unsigned flash_size = (unsigned)((firmware.size + STANDALONE_FLASH_PAGE_SIZE - 1u) & ~(STANDALONE_FLASH_PAGE_SIZE - 1u));
+
+    if (options.eeprom_filename != NULL) {
+        eeprom_config_t config;
+        uint32_t clock_calibration;
+
+        if (!eeprom_image_read(&eeprom, options.eeprom_filename, &error)) {
+            fprintf(stderr, "%s: %s\n", options.eeprom_filename, error);
+            return 1;
+        }
+        if (eeprom_image_check(&eeprom, stderr) != 0u) {
+            return 1;
+        }
+        if (eeprom_image_get_legacy_calibration(&eeprom, &clock_calibration) ||
+            (eeprom_image_get_config(&eeprom, &config) && (config.flags & EEPROM_CONFIG_FLAG_CLOCK_CALIBRATION))) {
+            fprintf(stderr, "%s: warning, holds a clock calibration, it replaces the calibration of every board.\n",
+                    options.eeprom_filename);
+        }
+    }
+    if (options.fuses[1] & STANDALONE_FUSE_HIGH_EESAVE) {
+        fprintf(stderr, "warning, EESAVE isn't programmed, the chip erase clears the clock calibration of every board.\n");
+    }
+
+    FILE* f_handle = fopen(options.output_filename, "w");
+    if (f_handle == NULL) {
+        perror(options.output_filename);
+        return 1;
+    }
+
+    uint32_t crc = ~crc32_update(CRC32_INITIAL, firmware.data, (uint16_t)flash_size);
+    fprintf(f_handle, "// Generated by tools/standalone_image.cpp, do not edit.\n");
+    fprintf(f_handle, "// Firmware: %s, CRC32 %08lX (isp_verify --size %u)\n", options.firmware_filename, (unsigned long)crc,
+            flash_size);
+    fprintf(f_handle, "// Eeprom:   %s\n", (options.eeprom_filename != NULL) ? options.eeprom_filename : "none");
+    fprintf(f_handle, "#ifndef STANDALONE_IMAGE_H\n#define STANDALONE_IMAGE_H\n\n");
+    fprintf(f_handle, "#define STANDALONE_SIGNATURE {0x%02X, 0x%02X, 0x%02X}\n", STANDALONE_SIGNATURE_0, STANDALONE_SIGNATURE_1,
+            STANDALONE_SIGNATURE_2);
+    fprintf(f_handle, "#define STANDALONE_FLASH_PAGE_SIZE %u\n", STANDALONE_FLASH_PAGE_SIZE);
+    fprintf(f_handle, "#define STANDALONE_EEPROM_PAGE_SIZE %u\n", STANDALONE_EEPROM_PAGE_SIZE);
+    fprintf(f_handle, "#define STANDALONE_EEPROM_SIZE %u\n", EEPROM_SIZE_BYTES);
+    fprintf(f_handle, "// low, high, extended\n");
+    fprintf(f_handle, "#define STANDALONE_FUSES {0x%02X, 0x%02X, 0x%02X}\n\n", options.fuses[0], options.fuses[1], options.fuses[2]);
+    fprintf(f_handle, "static const uint8_t standalone_flash[%u] PROGMEM = {\n", flash_size);
+    write_bytes(f_handle, firmware.data, flash_size);
+    fprintf(f_handle, "};\n\n");
+    fprintf(f_handle, "// address (MSB first), length, data; a length of 0 ends the blocks\n");
+    fprintf(f_handle, "static const uint8_t standalone_eeprom[] PROGMEM = {\n");
+    unsigned eeprom_size = write_eeprom_blocks(f_handle, (options.eeprom_filename != NULL) ? &eeprom : NULL);
+    fprintf(f_handle, "};\n\n#endif // STANDALONE_IMAGE_H\n");
+    if (fclose(f_handle) != 0) {
+        perror(options.output_filename);
+        return 1;
+    }
+
+    printf("%s: flash %u bytes (CRC32 %08lX), eeprom %u bytes, fuses 0x%02X 0x%02X 0x%02X.\n", options.output_filename,
+           flash_size, (unsigned long)crc, eeprom_size, options.fuses[0], options.fuses[1], options.fuses[2]);
+    return 0;
+}
@@ -0,0 +1,503 @@
+/// @file stk500v2_sim.cpp
+/// Host tool: run the STK500v2 protocol engine of the ArduinoISP (`arduino_as_isp/include/stk500v2.h`) against
+/// a modelled ATtiny85. Plays the avrdude side of a programming session byte by byte through the message parser:
+/// sign on, enter programming mode, signature, chip erase, flash and eeprom write and read back, fuses, SPI multi,
+/// a message with a wrong checksum and garbage between messages. Every answer frame is checked (sequence number,
+/// size, checksum, status) and the memories of the modelled target are compared with the written images.
+///
+/// The modelled target executes the ISP instructions of the datasheet (pg. 151), stays busy for some RDY/BSY polls
+/// after every write and counts instructions sent while it is busy.
+///
+/// Build: g++ -O2 -std=c++11 -Iarduino_as_isp/include -o stk500v2_sim tools/stk500v2_sim.cpp
+/// Usage: stk500v2_sim [--baud BAUD] [--seed N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "stk500v2.h"
+
+#define TARGET_FLASH_SIZE 8192u
+#define TARGET_FLASH_PAGE_SIZE 64u
+#define TARGET_EEPROM_SIZE 512u
+#define TARGET_EEPROM_PAGE_SIZE 4u
+
+/// RDY/BSY polls answered with busy after a write.
+#define TARGET_BUSY_POLLS 3u
+
+/// The modelled ATtiny85.
+typedef struct target {
+    bool reset;
+    bool programming_enabled;
+    uint8_t instruction[4];
+    uint8_t byte_index;
+    uint8_t busy_polls;
+    unsigned long busy_violations;
+    unsigned long flash_page_writes;
+    uint8_t flash[TARGET_FLASH_SIZE];
+    uint8_t flash_page[TARGET_FLASH_PAGE_SIZE];
+    uint8_t eeprom[TARGET_EEPROM_SIZE];
+    uint8_t eeprom_page[TARGET_EEPROM_PAGE_SIZE];
+    bool eeprom_page_loaded[TARGET_EEPROM_PAGE_SIZE];
+    uint8_t fuses[3];
+    uint8_t lock;
+} target_t;
+
+static target_t target;
+static unsigned long delay_ms;
+
+/// Execute a complete ISP instruction.
+///
+/// @param instruction The 4 bytes.
+/// @return The byte shifted out during the 4th byte.
+static uint8_t target_execute(const uint8_t* instruction) {
+    uint16_t address = ((uint16_t)instruction[1] << 8u) | instruction[2];
+    uint8_t data = instruction[3];
+
+    if (instruction[0] == 0xF0u) {
+        if (target.busy_polls > 0u) {
+            target.busy_polls--;
+            return 0x01u;
+        }
+        return 0x00u;
+    }
+    if (target.busy_polls > 0u) {
+        target.busy_violations++;
+        return 0x00u;
+    }
+
+    switch (instruction[0]) {
+    case 0x40u:
+    case 0x48u:
+        target.flash_page[((address % (TARGET_FLASH_PAGE_SIZE / 2u)) * 2u) + ((instruction[0] == 0x48u) ? 1u : 0u)] = data;
+        return 0x00u;
+    case 0x4Cu: {
+        // Programming can only clear bits, the page buffer is erased afterwards.
+        uint16_t page = (address * 2u) % TARGET_FLASH_SIZE & ~(TARGET_FLASH_PAGE_SIZE - 1u);
+        target.flash_page_writes++;
+        for (uint16_t index = 0u; index < TARGET_FLASH_PAGE_SIZE; index++) {
+            target.flash[page + index] &= target.flash_page[index];
+            target.flash_page[index] = 0xFFu;
+        }
+        target.busy_polls = TARGET_BUSY_POLLS;
+        return 0x00u;
+    }
+    case 0x20u:
+    case 0x28u:
+        return target.flash[((address * 2u) + ((instruction[0] == 0x28u) ? 1u : 0u)) % TARGET_FLASH_SIZE];
+    case 0xC0u:
+        target.eeprom[address % TARGET_EEPROM_SIZE] = data;
+        target.busy_polls = TARGET_BUSY_POLLS;
+        return 0x00u;
+    case 0xC1u:
+        target.eeprom_page[address % TARGET_EEPROM_PAGE_SIZE] = data;
+        target.eeprom_page_loaded[address % TARGET_EEPROM_PAGE_SIZE] = true;
+        return 0x00u;
+    case 0xC2u:
+        // Only the loaded bytes are written.
+        for (uint16_t index = 0u; index < TARGET_EEPROM_PAGE_SIZE; index++) {
+            if (target.eeprom_page_loaded[index]) {
+                target.eeprom[((address & ~(TARGET_EEPROM_PAGE_SIZE - 1u)) + index) % TARGET_EEPROM_SIZE] =
+                    target.eeprom_page[index];
+                target.eeprom_page_loaded[index] = false;
+            }
+        }
+        target.busy_polls = TARGET_BUSY_POLLS;
+        return 0x00u;
+    case 0xA0u:
+        return target.eeprom[address % TARGET_EEPROM_SIZE];
+    case 0x30u: {
+        static const uint8_t signature[3] = {0x1Eu, 0x93u, 0x0Bu};
+        return signature[instruction[2] % 3u];
+    }
+    case 0x50u:
+        return (instruction[1] == 0x08u) ? target.fuses[2] : target.fuses[0];
+    case 0x58u:
+        return (instruction[1] == 0x08u) ? target.fuses[1] : target.lock;
+    case 0xACu:
+        switch (instruction[1]) {
+        case 0x80u:
+            // Chip erase, EESAVE (hfuse bit 6) programmed keeps the eeprom.
+            memset(target.flash, 0xFF, sizeof(target.flash));
+            if (target.fuses[1] & 0x40u) {
+                memset(target.eeprom, 0xFF, sizeof(target.eeprom));
+            }
+            target.lock = 0xFFu;
+            target.busy_polls = TARGET_BUSY_POLLS;
+            break;
+        case 0xA0u:
+            target.fuses[0] = data;
+            target.busy_polls = TARGET_BUSY_POLLS;
+            break;
+        case 0xA8u:
+            target.fuses[1] = data;
+            target.busy_polls = TARGET_BUSY_POLLS;
+            break;
+        case 0xA4u:
+            target.fuses[2] = data;
+            target.busy_polls = TARGET_BUSY_POLLS;
+            break;
+        case 0xE0u:
+            target.lock = data;
+            target.busy_polls = TARGET_BUSY_POLLS;
+            break;
+        default:
+            break;
+        }
+        return 0x00u;
+    default:
+        return 0x00u;
+    }
+}
+
+uint8_t stk500v2_isp_transfer(uint8_t data) {
+    uint8_t index = target.byte_index;
+    uint8_t result = 0x00u;
+
+    if (target.reset == false) {
+        return 0xFFu;
+    }
+
+    // The target echoes the 2nd byte during the 3rd one, the result follows with the 4th one.
+    target.instruction[index] = data;
+    target.byte_index = (uint8_t)((index + 1u) % 4u);
+    if (index == 2u) {
+        result = target.instruction[1];
+    } else if (index == 3u) {
+        if (target.instruction[0] == 0xACu && target.instruction[1] == 0x53u) {
+            target.programming_enabled = true;
+        } else if (target.programming_enabled) {
+            result = target_execute(target.instruction);
+        }
+    }
+    return result;
+}
+
+bool stk500v2_isp_enter(const stk500v2_session_t* session) {
+    const uint8_t enable[4] = {0xACu, 0x53u, 0x00u, 0x00u};
+
+    (void)session;
+    target.reset = true;
+    target.byte_index = 0u;
+    return stk500v2_isp_instruction(enable, 2u) == 0x53u;
+}
+
+void stk500v2_isp_leave(void) {
+    target.reset = false;
+    target.programming_enabled = false;
+}
+
+bool stk500v2_isp_wait_ready(bool /* flash_page */) {
+    const uint8_t poll[4] = {0xF0u, 0x00u, 0x00u, 0x00u};
+
+    for (uint8_t polls = 0u; polls < 100u; polls++) {
+        if ((stk500v2_isp_instruction(poll, 3u) & 0x01u) == 0u) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void stk500v2_delay_ms(uint8_t ms) {
+    delay_ms += ms;
+}
+
+/// The programmer: the sketch's message loop with the parser and the session.
+typedef struct programmer {
+    stk500v2_parser_t parser;
+    stk500v2_session_t session;
+    uint8_t buffer[STK500V2_BODY_MAX];
+} programmer_t;
+
+/// The host side of the session.
+typedef struct host {
+    programmer_t programmer;
+    uint8_t sequence;
+    unsigned long messages;
+    unsigned long bytes;
+    unsigned errors;
+} host_t;
+
+/// Feed bytes into the programmer and collect its answer frames.
+///
+/// @param programmer The programmer.
+/// @param data The bytes.
+/// @param answers The answer frames, appended.
+static void programmer_receive(programmer_t* programmer, const std::vector<uint8_t>& data, std::vector<uint8_t>* answers) {
+    for (size_t index = 0u; index < data.size(); index++) {
+        uint8_t result = stk500v2_receive(&programmer->parser, programmer->buffer, data[index]);
+        uint8_t header[STK500V2_HEADER_SIZE];
+        uint16_t size;
+
+        if (result == STK500V2_RECEIVING) {
+            continue;
+        }
+        size = (result == STK500V2_MESSAGE)
+                   ? stk500v2_command(&programmer->session, programmer->buffer, programmer->parser.size)
+                   : stk500v2_checksum_error(programmer->buffer);
+        stk500v2_answer_header(&programmer->parser, size, header);
+        answers->insert(answers->end(), header, header + sizeof(header));
+        answers->insert(answers->end(), programmer->buffer, programmer->buffer + size);
+        answers->push_back(
+            stk500v2_checksum(stk500v2_checksum(0u, header, sizeof(header)), programmer->buffer, size));
+    }
+}
+
+/// Build a message frame.
+///
+/// @param sequence The sequence number.
+/// @param body The message body.
+/// @return The frame.
+static std::vector<uint8_t> frame(uint8_t sequence, const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> message = {STK500V2_MESSAGE_START, sequence, (uint8_t)(body.size() >> 8u),
+                                    (uint8_t)body.size(), STK500V2_TOKEN};
+    message.insert(message.end(), body.begin(), body.end());
+    message.push_back(stk500v2_checksum(0u, message.data(), (uint16_t)message.size()));
+    return message;
+}
+
+/// Send a message, check the answer frame and its status.
+///
+/// @param host The host.
+/// @param body The message body.
+/// @param answer The answer body.
+/// @return False if the answer is missing, broken or not ok.
+static bool transact(host_t* host, const std::vector<uint8_t>& body, std::vector<uint8_t>* answer) {
+    std::vector<uint8_t> message = frame(host->sequence, body);
+    std::vector<uint8_t> received;
+
+    programmer_receive(&host->programmer, message, &received);
+    host->messages++;
+    host->bytes += message.size() + received.size();
+
+    if (received.size() < STK500V2_HEADER_SIZE + 3u || received[0] != STK500V2_MESSAGE_START ||
+        received[1] != host->sequence || received[4] != STK500V2_TOKEN ||
+        (((size_t)received[2] << 8u) | received[3]) != received.size() - STK500V2_HEADER_SIZE - 1u ||
+        stk500v2_checksum(0u, received.data(), (uint16_t)received.size()) != 0u) {
+        fprintf(stderr, "Command 0x%02X: broken answer frame (%u bytes).\n", (unsigned)body[0], (unsigned)received.size());
+        host->errors++;
+        return false;
+    }
+    host->sequence++;
+
+    answer->assign(received.begin() + STK500V2_HEADER_SIZE, received.end() - 1);
+    if ((*answer)[0] != body[0] || (*answer)[1] != STK500V2_STATUS_CMD_OK) {
+        fprintf(stderr, "Command 0x%02X: answer 0x%02X, status 0x%02X.\n", (unsigned)body[0], (unsigned)(*answer)[0],
+                (unsigned)(*answer)[1]);
+        host->errors++;
+        return false;
+    }
+    return true;
+}
+
+/// Report a failed check.
+///
+/// @param host The host.
+/// @param ok The result of the check.
+/// @param what The checked property.
+static void check(host_t* host, bool ok, const char* what) {
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        host->errors++;
+    }
+}
+
+/// Load the address of the next memory access.
+///
+/// @param host The host.
+/// @param address Word address (flash) or byte address (eeprom).
+static void load_address(host_t* host, uint32_t address) {
+    std::vector<uint8_t> answer;
+    transact(host,
+             {STK500V2_CMD_LOAD_ADDRESS, (uint8_t)(address >> 24u), (uint8_t)(address >> 16u), (uint8_t)(address >> 8u),
+              (uint8_t)address},
+             &answer);
+}
+
+/// Write a memory in blocks like avrdude.
+///
+/// @param host The host.
+/// @param command Program flash or eeprom.
+/// @param image The data.
+/// @param block_size The bytes per message (the page size).
+/// @param mode The mode byte.
+/// @param commands cmd1 (load/write), cmd2 (write page), cmd3 (read).
+static void write_memory(host_t* host, uint8_t command, const std::vector<uint8_t>& image, uint16_t block_size,
+                         uint8_t mode, const uint8_t* commands) {
+    std::vector<uint8_t> answer;
+
+    load_address(host, 0u);
+    for (size_t start = 0u; start < image.size(); start += block_size) {
+        std::vector<uint8_t> body = {command, (uint8_t)(block_size >> 8u), (uint8_t)block_size, mode, 10u,
+                                     commands[0], commands[1], commands[2], 0xFFu, 0xFFu};
+        body.insert(body.end(), image.begin() + start, image.begin() + start + block_size);
+        transact(host, body, &answer);
+    }
+}
+
+/// Read a memory back in blocks of 256 bytes like avrdude.
+///
+/// @param host The host.
+/// @param command Read flash or eeprom.
+/// @param read_command cmd1.
+/// @param size The memory size.
+/// @return The data.
+static std::vector<uint8_t> read_memory(host_t* host, uint8_t command, uint8_t read_command, size_t size) {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> answer;
+
+    load_address(host, 0u);
+    for (size_t start = 0u; start < size; start += 256u) {
+        if (!transact(host, {command, 0x01u, 0x00u, read_command}, &answer) || answer.size() != 256u + 3u) {
+            break;
+        }
+        data.insert(data.end(), answer.begin() + 2, answer.end() - 1);
+    }
+    return data;
+}
+
+/// Read a byte with a 4 byte ISP instruction.
+///
+/// @param host The host.
+/// @param command Read fuse, lock or signature.
+/// @param instruction The ISP instruction.
+/// @return The byte, -1 on error.
+static int read_byte(host_t* host, uint8_t command, const uint8_t* instruction) {
+    std::vector<uint8_t> answer;
+
+    if (!transact(host, {command, 4u, instruction[0], instruction[1], instruction[2], instruction[3]}, &answer) ||
+        answer.size() != 4u) {
+        return -1;
+    }
+    return answer[2];
+}
+
+int main(int argc, char** argv) {
+    host_t host;
+    std::vector<uint8_t> answer;
+    std::vector<uint8_t> flash(TARGET_FLASH_SIZE);
+    std::vector<uint8_t> eeprom(TARGET_EEPROM_SIZE);
+    unsigned long baud = 115200u;
+    unsigned seed = 1u;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--baud") == 0 && (arg + 1) < argc) {
+            baud = strtoul(argv[++arg], NULL, 0);
+        } else if (strcmp(argv[arg], "--seed") == 0 && (arg + 1) < argc) {
+            seed = (unsigned)strtoul(argv[++arg], NULL, 0);
+        } else {
+            fprintf(stderr, "Usage: stk500v2_sim [--baud BAUD] [--seed N]\n");
+            return 2;
+        }
+    }
+
+    // Random images, the second half of the flash is left blank like behind a real firmware.
+    srand(seed);
+    for (size_t index = 0u; index < flash.size(); index++) {
+        flash[index] = (index < flash.size() / 2u) ? (uint8_t)rand() : 0xFFu;
+    }
+    for (size_t index = 0u; index < eeprom.size(); index++) {
+        eeprom[index] = (uint8_t)rand();
+    }
+
+    memset(&target, 0, sizeof(target));
+    memset(target.flash, 0x5A, sizeof(target.flash));
+    memset(target.flash_page, 0xFF, sizeof(target.flash_page));
+    target.fuses[0] = 0x62u;
+    target.fuses[1] = 0xDFu;
+    target.fuses[2] = 0xFFu;
+    target.lock = 0xFFu;
+
+    memset(&host, 0, sizeof(host));
+    stk500v2_init(&host.programmer.session);
+
+    check(&host, transact(&host, {STK500V2_CMD_SIGN_ON}, &answer) && answer.size() == 11u &&
+                     memcmp(&answer[3], "STK500_2", 8u) == 0,
+          "Sign on");
+    check(&host, transact(&host, {STK500V2_CMD_GET_PARAMETER, STK500V2_PARAM_SW_MAJOR}, &answer) && answer[2] == 2u,
+          "Software version");
+    check(&host,
+          transact(&host, {STK500V2_CMD_ENTER_PROGMODE_ISP, 200u, 100u, 25u, 32u, 0u, 0x53u, 3u, 0xACu, 0x53u, 0x00u, 0x00u},
+                   &answer),
+          "Enter programming mode");
+
+    const uint8_t signature_instructions[3][4] = {{0x30u, 0u, 0u, 0u}, {0x30u, 0u, 1u, 0u}, {0x30u, 0u, 2u, 0u}};
+    check(&host, read_byte(&host, STK500V2_CMD_READ_SIGNATURE_ISP, signature_instructions[0]) == 0x1E &&
+                     read_byte(&host, STK500V2_CMD_READ_SIGNATURE_ISP, signature_instructions[1]) == 0x93 &&
+                     read_byte(&host, STK500V2_CMD_READ_SIGNATURE_ISP, signature_instructions[2]) == 0x0B,
+          "Signature 1E 93 0B");
+
+    check(&host, transact(&host, {STK500V2_CMD_CHIP_ERASE_ISP, 10u, 1u, 0xACu, 0x80u, 0x00u, 0x00u}, &answer),
+          "Chip erase");
+
+    // avrdude.conf of the ATtiny85: flash mode 0x41, page 64, eeprom mode 0x41, page 4.
+    const uint8_t flash_commands[3] = {0x40u, 0x4Cu, 0x20u};
+    const uint8_t eeprom_commands[3] = {0xC1u, 0xC2u, 0xA0u};
+    unsigned long messages = host.messages;
+    write_memory(&host, STK500V2_CMD_PROGRAM_FLASH_ISP, flash, TARGET_FLASH_PAGE_SIZE, 0xC1u, flash_commands);
+    unsigned long flash_messages = host.messages - messages;
+    check(&host, read_memory(&host, STK500V2_CMD_READ_FLASH_ISP, 0x20u, flash.size()) == flash, "Flash written and read back");
+
+    // The blank second half of the image is skipped.
+    unsigned blank_pages = 0u;
+    for (size_t start = 0u; start < flash.size(); start += TARGET_FLASH_PAGE_SIZE) {
+        bool blank = true;
+        for (size_t index = start; index < start + TARGET_FLASH_PAGE_SIZE; index++) {
+            blank = blank && (flash[index] == 0xFFu);
+        }
+        blank_pages += blank ? 1u : 0u;
+    }
+    std::vector<uint8_t> answer_high;
+    check(&host,
+          transact(&host, {STK500V2_CMD_GET_PARAMETER, STK500V2_PARAM_BLANK_PAGES_LOW}, &answer) &&
+              transact(&host, {STK500V2_CMD_GET_PARAMETER, STK500V2_PARAM_BLANK_PAGES_HIGH}, &answer_high) &&
+              (unsigned)(answer[2] | (answer_high[2] << 8u)) == blank_pages &&
+              target.flash_page_writes == (TARGET_FLASH_SIZE / TARGET_FLASH_PAGE_SIZE) - blank_pages,
+          "Blank flash pages skipped");
+
+    write_memory(&host, STK500V2_CMD_PROGRAM_EEPROM_ISP, eeprom, TARGET_EEPROM_PAGE_SIZE, 0xC1u, eeprom_commands);
+    check(&host, read_memory(&host, STK500V2_CMD_READ_EEPROM_ISP, 0xA0u, eeprom.size()) == eeprom,
+          "Eeprom written and read back (page mode)");
+
+    // Word mode with RDY/BSY polling (mode bit 3), one byte per instruction.
+    const uint8_t eeprom_byte_commands[3] = {0xC0u, 0x00u, 0xA0u};
+    for (size_t index = 0u; index < eeprom.size(); index++) {
+        eeprom[index] = (uint8_t)~eeprom[index];
+    }
+    write_memory(&host, STK500V2_CMD_PROGRAM_EEPROM_ISP, eeprom, 16u, 0x08u, eeprom_byte_commands);
+    check(&host, read_memory(&host, STK500V2_CMD_READ_EEPROM_ISP, 0xA0u, eeprom.size()) == eeprom,
+          "Eeprom written and read back (byte mode)");
+
+    const uint8_t read_lfuse[4] = {0x50u, 0x00u, 0x00u, 0x00u};
+    check(&host,
+          transact(&host, {STK500V2_CMD_PROGRAM_FUSE_ISP, 0xACu, 0xA0u, 0x00u, 0x94u}, &answer) && answer.size() == 3u &&
+              read_byte(&host, STK500V2_CMD_READ_FUSE_ISP, read_lfuse) == 0x94,
+          "Low fuse written and read back");
+
+    check(&host,
+          transact(&host, {STK500V2_CMD_SPI_MULTI, 4u, 4u, 0u, 0x30u, 0x00u, 0x01u, 0x00u}, &answer) &&
+              answer.size() == 7u && answer[4] == 0x00u && answer[5] == 0x93u,
+          "SPI multi");
+
+    // A damaged message gets the checksum error answer, garbage between messages is dropped.
+    std::vector<uint8_t> damaged = frame(host.sequence, {STK500V2_CMD_GET_PARAMETER, STK500V2_PARAM_HW_VER});
+    std::vector<uint8_t> received;
+    damaged.back() ^= 0x01u;
+    programmer_receive(&host.programmer, damaged, &received);
+    check(&host, received.size() == 8u && received[5] == STK500V2_ANSWER_CKSUM_ERROR && received[6] == STK500V2_STATUS_CKSUM_ERROR,
+          "Checksum error answered");
+    received.clear();
+    programmer_receive(&host.programmer, {0x00u, 0x55u, 0xAAu, 0x0Eu}, &received);
+    check(&host, received.empty() && transact(&host, {STK500V2_CMD_GET_PARAMETER, STK500V2_PARAM_HW_VER}, &answer),
+          "Resync after garbage");
+
+    check(&host, transact(&host, {STK500V2_CMD_LEAVE_PROGMODE_ISP, 1u, 1u}, &answer), "Leave programming mode");
+    check(&host, target.busy_violations == 0u, "No instruction while the target is busy");
+
+    // STK500v1 needs a load address and a program page command per page.
+    printf("\nFlash: %lu messages for %u pages (STK500v1: %u), %u blank pages skipped\n", flash_messages,
+           TARGET_FLASH_SIZE / TARGET_FLASH_PAGE_SIZE, 2u * (TARGET_FLASH_SIZE / TARGET_FLASH_PAGE_SIZE), blank_pages);
+    printf("Session: %lu messages, %lu bytes, %.2fs serial at %lu baud, %lums delays\n", host.messages, host.bytes,
+           host.bytes * 10.0 / baud, baud, delay_ms);
+    printf("%u errors\n", host.errors);
+    return (host.errors == 0u) ? 0 : 1;
+}
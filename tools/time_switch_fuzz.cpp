@@ -0,0 +1,332 @@
+/// @file time_switch_fuzz.cpp
+/// Host tool: property based fuzzing of the load switching logic in `time_switch.h`.
+///
+/// Every run draws random jumper settings, timing parameters, raw clock calibration eeprom bytes (also out of range
+/// ones, which the firmware discards) and a random battery voltage walk, and advances the state machine wakeup by
+/// wakeup like the firmware does. Now and then the state is corrupted on purpose: an invalid wake state, counters
+/// close to their maximum or a resumed phase. After every step the invariants are checked:
+/// - the load is never on after an undervoltage trip, and a trip is never undone,
+/// - the counters saturate instead of wrapping around,
+/// - the wake state is valid and agrees with the load (a corrupted one is recovered with the load off),
+/// - an undisturbed on/off phase lasts exactly the calibrated timing, calibrated without overflow.
+/// Before the runs the clock calibration is checked for every accepted frequency at the longest accepted timing.
+///
+/// The runs are reproducible with `--seed`, a violation is reported with its seed, run and wakeup.
+/// The tool exits with 1 on any violation.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o time_switch_fuzz tools/time_switch_fuzz.cpp
+/// Usage: time_switch_fuzz [--seed N] [--runs N] [--wakeups N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "time_switch.h"
+
+/// Stop reporting after this many violations.
+#define FUZZ_VIOLATIONS_REPORTED 20u
+
+/// The settings of a fuzzing session.
+typedef struct fuzz_options {
+    uint32_t seed;
+    unsigned long runs;
+    unsigned long wakeups;
+} fuzz_options_t;
+
+/// The state of one run, for the checks and the reports.
+typedef struct fuzz_run {
+    unsigned long run;
+    unsigned long wakeup;
+    unsigned long violations;
+
+    /// The wakeups since the last load switching, -1 after a disturbance until the next switching.
+    long phase_wakeups;
+} fuzz_run_t;
+
+/// xorshift32: fast and the same sequence on every host.
+///
+/// @param state The generator state, not 0.
+/// @return The next value.
+static uint32_t fuzz_random(uint32_t* state) {
+    *state ^= *state << 13u;
+    *state ^= *state >> 17u;
+    *state ^= *state << 5u;
+    return *state;
+}
+
+/// Draw a value in a range.
+///
+/// @param state The generator state.
+/// @param low The lowest value.
+/// @param high The highest value.
+/// @return The value.
+static uint32_t fuzz_range(uint32_t* state, uint32_t low, uint32_t high) {
+    return low + fuzz_random(state) % (high - low + 1u);
+}
+
+/// Report a violated invariant.
+///
+/// @param run The run.
+/// @param options The session, for the seed.
+/// @param message The invariant.
+static void violation(fuzz_run_t* run, const fuzz_options_t* options, const char* message) {
+    if (run->violations++ < FUZZ_VIOLATIONS_REPORTED) {
+        printf("seed %lu run %lu wakeup %lu: %s\n", (unsigned long)options->seed, run->run, run->wakeup, message);
+    }
+}
+
+/// Draw a timing value: mostly short ones so many phases complete, sometimes the extremes.
+///
+/// @param random The generator state.
+/// @return The timing in wakeups, 1..@ref TIMING_CYCLES_MAX.
+static uint16_t random_timing(uint32_t* random) {
+    switch (fuzz_random(random) % 8u) {
+    case 0u:
+        return 1u;
+    case 1u:
+        return (uint16_t)TIMING_CYCLES_MAX;
+    case 2u:
+        return (uint16_t)fuzz_range(random, 1u, TIMING_CYCLES_MAX);
+    default:
+        return (uint16_t)fuzz_range(random, 1u, 200u);
+    }
+}
+
+/// Draw the clock calibration as read from the eeprom: erased, random bytes or a valid frequency.
+///
+/// @param random The generator state.
+/// @return The clock calibration.
+static uint32_t random_calibration(uint32_t* random) {
+    switch (fuzz_random(random) % 4u) {
+    case 0u:
+        return 0xFFFFFFFFlu;
+    case 1u:
+        return fuzz_random(random);
+    default:
+        return fuzz_range(random, SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ,
+                          SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ);
+    }
+}
+
+/// The calibrated timing as calculated without overflow.
+///
+/// @param clock_calibration The clock calibration.
+/// @param timing The uncalibrated timing.
+/// @return The expected result of `apply_clock_calibration()`.
+static uint32_t expected_calibration(uint32_t clock_calibration, uint16_t timing) {
+    if (clock_calibration < SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ ||
+        clock_calibration > SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ) {
+        return timing;
+    }
+    return (uint32_t)(((uint64_t)clock_calibration * timing) / SLEEP_CLOCK_VALUE_HZ);
+}
+
+/// Check the clock calibration at the bounds: every accepted frequency applied to the longest accepted timing and
+/// to the timings where a 32 bit product of frequency and timing starts to overflow.
+///
+/// @param options The session, for the reports.
+/// @param run The run, counts the violations.
+static void check_clock_calibration(const fuzz_options_t* options, fuzz_run_t* run) {
+    const uint16_t timings[] = {1u, 27182u, 27183u, 27184u, (uint16_t)(TIMING_CYCLES_MAX - 1u), (uint16_t)TIMING_CYCLES_MAX};
+    time_switch_parameters_t parameters;
+    char message[128];
+
+    time_switch_default_parameters(&parameters);
+    parameters.timing_cycles_load_on_12v = (uint16_t)TIMING_CYCLES_MAX;
+    if (!time_switch_parameters_valid(&parameters)) {
+        violation(run, options, "TIMING_CYCLES_MAX rejected");
+    }
+    parameters.timing_cycles_load_on_12v = (uint16_t)(TIMING_CYCLES_MAX + 1u);
+    if (time_switch_parameters_valid(&parameters)) {
+        violation(run, options, "TIMING_CYCLES_MAX + 1 accepted");
+    }
+
+    for (uint8_t timing = 0u; timing < (sizeof(timings) / sizeof(timings[0])); timing++) {
+        for (uint32_t clock_calibration = SLEEP_CLOCK_VALUE_HZ - SLEEP_CLOCK_DEVIATION_MAX_HZ - 1u;
+             clock_calibration <= SLEEP_CLOCK_VALUE_HZ + SLEEP_CLOCK_DEVIATION_MAX_HZ + 1u; clock_calibration++) {
+            uint32_t calibrated = apply_clock_calibration(clock_calibration, timings[timing]);
+            if (calibrated != expected_calibration(clock_calibration, timings[timing]) || calibrated > 0xFFFFu) {
+                snprintf(message, sizeof(message), "%u wakeups calibrated with %luHz: %lu instead of %lu",
+                         (unsigned)timings[timing], (unsigned long)clock_calibration, (unsigned long)calibrated,
+                         (unsigned long)expected_calibration(clock_calibration, timings[timing]));
+                violation(run, options, message);
+            }
+        }
+    }
+}
+
+/// Fuzz one run.
+///
+/// @param options The session.
+/// @param run The run, counts the violations.
+/// @param random The generator state.
+static void fuzz_one_run(const fuzz_options_t* options, fuzz_run_t* run, uint32_t* random) {
+    time_switch_parameters_t parameters;
+    time_switch_config_t config;
+    time_switch_state_t state;
+    bool all_features_activated = (fuzz_random(random) & 1u) != 0u;
+    bool _12_24V_selection = (fuzz_random(random) & 1u) != 0u;
+    bool clock_calibration_present = (fuzz_random(random) & 1u) != 0u;
+    uint32_t clock_calibration = random_calibration(random);
+    uint16_t battery_voltage = (uint16_t)fuzz_range(random, 0u, 1023u);
+
+    parameters.timing_cycles_load_on_12v = random_timing(random);
+    parameters.timing_cycles_load_off_12v = random_timing(random);
+    parameters.timing_cycles_load_on_24v = random_timing(random);
+    parameters.timing_cycles_load_off_24v = random_timing(random);
+    parameters.adc_threshold_12v = (uint16_t)fuzz_range(random, 0u, 1023u);
+    parameters.adc_threshold_24v = (uint16_t)fuzz_range(random, 0u, 1023u);
+    if (!time_switch_parameters_valid(&parameters)) {
+        violation(run, options, "random parameters rejected");
+        return;
+    }
+
+    time_switch_configure(&config, &parameters, all_features_activated, _12_24V_selection, clock_calibration_present,
+                          clock_calibration);
+    if (clock_calibration_present &&
+        (config.timing_cycles_load_on != expected_calibration(clock_calibration, config.timing_cycles_load_on_nominal) ||
+         config.timing_cycles_load_off != expected_calibration(clock_calibration, config.timing_cycles_load_off_nominal))) {
+        violation(run, options, "calibrated timing differs from the exact calculation");
+    }
+    time_switch_init(&state);
+    run->phase_wakeups = 0;
+
+    for (run->wakeup = 0u; run->wakeup < options->wakeups; run->wakeup++) {
+        uint32_t dice = fuzz_random(random) % 4096u;
+
+        // Disturbances, the firmware state after a brown-out, a resumed checkpoint or flipped bits.
+        if (dice == 0u) {
+            state.wake_state = (uint8_t)fuzz_range(random, 2u, 255u);
+            run->phase_wakeups = -1;
+        } else if (dice == 1u) {
+            state.wakeup_count_load_feature = (uint16_t)fuzz_range(random, UINT16_MAX - 3u, UINT16_MAX);
+            state.wakeup_count_undervoltage_protection = (uint16_t)fuzz_range(random, UINT16_MAX - 3u, UINT16_MAX);
+            run->phase_wakeups = -1;
+        } else if (dice == 2u && config.all_features_activated && !state.undervoltage_protection_triggered) {
+            // The firmware only resumes a checkpoint of the load feature.
+            time_switch_resume(&state, (uint8_t)fuzz_random(random), (uint16_t)fuzz_random(random));
+            run->phase_wakeups = -1;
+        }
+
+        // The battery walks slowly, with rare jumps.
+        if (dice < 64u) {
+            battery_voltage = (uint16_t)fuzz_range(random, 0u, 1023u);
+        } else if (dice < 1024u) {
+            battery_voltage = (uint16_t)((battery_voltage + 1023u + fuzz_range(random, 0u, 2u) - 1u) % 1024u);
+        }
+
+        const time_switch_state_t before = state;
+        const bool corrupted = (state.wake_state != STATE_LOAD_ON && state.wake_state != STATE_LOAD_OFF);
+
+        bool measure = time_switch_wakeup(&state);
+        if ((before.wakeup_count_load_feature == UINT16_MAX)
+                ? (state.wakeup_count_load_feature != UINT16_MAX)
+                : (state.wakeup_count_load_feature != before.wakeup_count_load_feature + 1u)) {
+            violation(run, options, "load feature counter wrapped");
+        }
+        if (!measure && ((before.wakeup_count_undervoltage_protection == UINT16_MAX)
+                             ? (state.wakeup_count_undervoltage_protection != UINT16_MAX)
+                             : (state.wakeup_count_undervoltage_protection != before.wakeup_count_undervoltage_protection + 1u))) {
+            violation(run, options, "undervoltage counter wrapped");
+        }
+        if (measure && (!state.load_enabled || state.wakeup_count_undervoltage_protection != 0u)) {
+            violation(run, options, "measurement while the load is off");
+        }
+        if (measure) {
+            time_switch_battery_measured(&state, &config, battery_voltage);
+        }
+
+        time_switch_update_load_timing(&state, &config);
+
+        if (before.undervoltage_protection_triggered && !state.undervoltage_protection_triggered) {
+            violation(run, options, "undervoltage trip undone");
+        }
+        if (state.undervoltage_protection_triggered && state.load_enabled) {
+            violation(run, options, "load on after an undervoltage trip");
+        }
+        if (!config.all_features_activated && !state.load_enabled && !state.undervoltage_protection_triggered) {
+            violation(run, options, "load off without the load feature and without a trip");
+        }
+        if (!config.all_features_activated || state.undervoltage_protection_triggered) {
+            continue;
+        }
+
+        // The load timing is active.
+        if (corrupted && (state.wake_state != STATE_LOAD_OFF || state.load_enabled || state.wakeup_count_load_feature != 0u)) {
+            violation(run, options, "corrupted wake state not recovered with the load off");
+        }
+        if (state.wake_state != STATE_LOAD_ON && state.wake_state != STATE_LOAD_OFF) {
+            violation(run, options, "invalid wake state");
+        }
+        if (state.load_enabled != (state.wake_state == STATE_LOAD_ON)) {
+            violation(run, options, "wake state and load disagree");
+        }
+
+        if (state.wake_state == before.wake_state && !corrupted) {
+            if (run->phase_wakeups >= 0) {
+                run->phase_wakeups++;
+            }
+            continue;
+        }
+
+        // A switching: an undisturbed phase lasts exactly the calibrated timing.
+        if (run->phase_wakeups >= 0 && !corrupted) {
+            long timing = (before.wake_state == STATE_LOAD_ON) ? config.timing_cycles_load_on : config.timing_cycles_load_off;
+            // A timing calibrated down to 0 (1 wakeup at a slow clock) still lasts one wakeup, the counter is
+            // advanced before it is compared.
+            timing = (timing == 0) ? 1 : timing;
+            if (run->phase_wakeups + 1 != timing) {
+                violation(run, options, "phase length differs from the calibrated timing");
+            }
+        }
+        run->phase_wakeups = 0;
+    }
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: time_switch_fuzz [options]\n"
+            "  --seed N      Seed of the first run, 0: from the time (default 1)\n"
+            "  --runs N      Runs with random settings (default 2000)\n"
+            "  --wakeups N   Wakeups per run (default 20000)\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    fuzz_options_t options = {1u, 2000u, 20000u};
+    fuzz_run_t run;
+    uint32_t random;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+
+        if ((arg + 1) >= argc) {
+            print_usage();
+        }
+
+        const char* argument = argv[++arg];
+        if (strcmp(option, "--seed") == 0) {
+            options.seed = (uint32_t)strtoul(argument, NULL, 0);
+        } else if (strcmp(option, "--runs") == 0) {
+            options.runs = strtoul(argument, NULL, 0);
+        } else if (strcmp(option, "--wakeups") == 0) {
+            options.wakeups = strtoul(argument, NULL, 0);
+        } else {
+            print_usage();
+        }
+    }
+    if (options.seed == 0u) {
+        options.seed = (uint32_t)time(NULL) | 1u;
+    }
+
+    memset(&run, 0, sizeof(run));
+    check_clock_calibration(&options, &run);
+    random = options.seed;
+    for (run.run = 0u; run.run < options.runs; run.run++) {
+        fuzz_one_run(&options, &run, &random);
+    }
+
+    printf("Seed %lu: %lu runs of %lu wakeups, %lu violations.\n", (unsigned long)options.seed, options.runs,
+           options.wakeups, run.violations);
+    return (run.violations == 0u) ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+# Golden trace regression suite of the load switching logic.
+#
+# Replays every trace of tools/traces with tools/trace_replay.cpp for all jumper combinations (12V/24V x all
+# features/undervoltage protection only), each without and with an eeprom clock calibration, and compares the
+# event streams (load switching, undervoltage trip and every battery measurement) with the golden event streams
+# in tools/traces/golden. The 12V jumper setting replays the _12v traces, the 24V one the _24v traces.
+#
+#   python tools/trace_regression.py                 Compare, exits with 1 on any difference or missing golden stream.
+#   python tools/trace_regression.py --update        Record the golden event streams, commit them with the change
+#                                                    that is supposed to change the switching behaviour.
+#
+# trace_replay is compiled into a temporary folder with --cxx (default g++), or --replay takes an existing binary.
+# The comparison streams both files and stops at the first divergent event, which is reported with its tick.
+import argparse
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+tools_dir = os.path.dirname(os.path.abspath(__file__))
+repo_dir = os.path.dirname(tools_dir)
+trace_dir = os.path.join(tools_dir, "traces")
+golden_dir = os.path.join(trace_dir, "golden")
+
+# The clock calibration of the calibrated runs, chip 001 of clock_calibrations.md.
+clock_calibration_hz = 110481
+
+# The jumper combinations: golden name part, trace_replay options, trace suffix.
+jumper_combinations = (
+    ("12v_all_features", ["--12v"], "_12v"),
+    ("12v_undervoltage_only", ["--12v", "--undervoltage-only"], "_12v"),
+    ("24v_all_features", ["--24v"], "_24v"),
+    ("24v_undervoltage_only", ["--24v", "--undervoltage-only"], "_24v"),
+)
+
+# Without and with the eeprom clock calibration: golden name part, trace_replay options.
+calibrations = (
+    ("", []),
+    ("_calibrated", ["--calibration", str(clock_calibration_hz)]),
+)
+
+
+def build_replay(cxx, build_dir):
+    replay = os.path.join(build_dir, "trace_replay")
+    subprocess.run([cxx, "-O2", "-std=c++11", "-I" + os.path.join(repo_dir, "include"), "-o", replay,
+                    os.path.join(tools_dir, "trace_replay.cpp")], check=True)
+    return replay
+
+
+def list_runs():
+    runs = []
+    for combination, jumper_options, suffix in jumper_combinations:
+        for trace in sorted(glob.glob(os.path.join(trace_dir, "*" + suffix + ".csv"))):
+            name = os.path.basename(trace)[:-len(suffix + ".csv")]
+            for calibration, calibration_options in calibrations:
+                golden = os.path.join(golden_dir, f"{name}_{combination}{calibration}.csv")
+                runs.append((golden, ["--measurements"] + jumper_options + calibration_options, trace))
+    return runs
+
+
+def relative(path):
+    return os.path.relpath(path, repo_dir).replace(os.sep, "/")
+
+
+def record(replay, golden, options, trace):
+    result = subprocess.run([replay] + options + [trace], stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                            universal_newlines=True)
+    if result.returncode != 0:
+        print(f"{relative(golden)}: trace_replay failed:\n{result.stderr}")
+        return False
+    with open(golden, "w", newline="\r\n") as f_handle:
+        f_handle.write(f"# trace_replay {' '.join(options)} {relative(trace)}\n")
+        f_handle.write(result.stdout)
+    return True
+
+
+def compare(replay, golden, options, trace):
+    if not os.path.exists(golden):
+        print(f"{relative(golden)}: missing, record it with --update")
+        return False
+    result = subprocess.run([replay] + options + ["--compare", golden, trace], stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        divergence = result.stderr.split("Configuration:")[0].rstrip()
+        print(f"{relative(golden)}: FAILED ({' '.join(options)} {relative(trace)})\n{divergence}")
+        return False
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Golden trace regression suite of the load switching logic.")
+    parser.add_argument("--update", action="store_true", help="Record the golden event streams.")
+    parser.add_argument("--replay", help="An existing trace_replay binary (default: compile it).")
+    parser.add_argument("--cxx", default="g++", help="The compiler for trace_replay.")
+    args = parser.parse_args()
+
+    build_dir = None
+    replay = args.replay
+    if replay is None:
+        build_dir = tempfile.mkdtemp(prefix="trace_regression_")
+        replay = build_replay(args.cxx, build_dir)
+
+    try:
+        runs = list_runs()
+        if not runs:
+            print(f"No traces found in '{relative(trace_dir)}'.")
+            return 1
+        if args.update:
+            os.makedirs(golden_dir, exist_ok=True)
+        failed = 0
+        for golden, options, trace in runs:
+            if not (record if args.update else compare)(replay, golden, options, trace):
+                failed += 1
+    finally:
+        if build_dir is not None:
+            shutil.rmtree(build_dir)
+
+    action = "recorded" if args.update else "match the golden event streams"
+    print(f"{len(runs) - failed} of {len(runs)} event streams {action}.")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,356 @@
+/// @file trace_replay.cpp
+/// Host tool: replay a supply voltage trace through the load switching logic of the firmware.
+///
+/// The trace is a CSV file with one sample per line: `time_s,value`. The value is the battery
+/// voltage in volts, or the raw 10 bit adc value with `--raw`. Empty lines, lines starting with `#`
+/// and a non-numeric header line are ignored. Voltages beyond the measurement range saturate like the adc,
+/// a raw value that isn't a 10 bit adc value stops the replay with its line number. Each sample holds until the next one (sample and hold),
+/// the replay ends with the last sample. The trace is streamed line by line, so traces of arbitrary
+/// length can be replayed with constant memory.
+///
+/// Every wakeup of the firmware (8.192s nominal) is simulated with the code from `time_switch.h`.
+/// All load switching events and the undervoltage trip are reported with their wakeup tick.
+///
+/// With `--compare` the event stream is checked against a golden event stream recorded earlier instead of being
+/// printed. The replay stops at the first divergent event and reports its tick.
+///
+/// Build: g++ -O2 -std=c++11 -Iinclude -o trace_replay tools/trace_replay.cpp
+/// Usage: trace_replay [--24v] [--undervoltage-only] [--calibration HZ] [--clock HZ] [--raw] [--measurements]
+///                     [--quiet] [--compare golden.csv] trace.csv
+/// Use `-` as the file name to read the trace from stdin.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "time_switch.h"
+
+/// The longest accepted trace line.
+#define TRACE_LINE_LENGTH_MAX 256u
+
+/// The largest raw adc value.
+#define TRACE_ADC_MAX 1023u
+
+/// The command line options.
+typedef struct replay_options {
+    bool _12_24V_selection;
+    bool all_features_activated;
+    bool clock_calibration_present;
+    uint32_t clock_calibration;
+    double sleep_clock_hz;
+    bool raw_adc_values;
+    bool measurement_events;
+    bool quiet;
+    const char* golden_filename;
+    const char* trace_filename;
+} replay_options_t;
+
+/// Where the events go: printed to stdout or compared against a golden event stream.
+typedef struct event_sink {
+    bool quiet;
+    FILE* golden;
+    unsigned long golden_line_number;
+} event_sink_t;
+
+/// Convert a battery voltage to the value returned by the firmware's `read_battery_voltage()`.
+///
+/// @param battery_voltage The battery voltage in volts.
+/// @param _12_24V_selection True: 12V voltage divider, false: 24V voltage divider.
+/// @return The battery voltage as a 10 bit value.
+static uint16_t battery_voltage_to_adc(double battery_voltage, bool _12_24V_selection) {
+    double r2 = (double)(_12_24V_selection ? VOLTAGE_DIVIDER_R2_12V_OHM : VOLTAGE_DIVIDER_R2_24V_OHM);
+    double ratio = r2 / (r2 + (double)VOLTAGE_DIVIDER_R1_OHM);
+    double adc = battery_voltage * ratio * (1000.0 / ADC_REFERENCE_MV) * 1023.0;
+
+    if (adc <= 0.0) {
+        return 0u;
+    }
+    if (adc >= (double)TRACE_ADC_MAX) {
+        return TRACE_ADC_MAX;
+    }
+    return (uint16_t)adc;
+}
+
+/// Check that a raw trace value is a 10 bit adc value.
+///
+/// @param value The parsed value.
+/// @return True if the firmware could have measured it.
+static bool raw_adc_value_valid(double value) {
+    return (value >= 0.0) && (value <= (double)TRACE_ADC_MAX) && (value == (double)(uint16_t)value);
+}
+
+/// Parse one trace line.
+///
+/// @param line The zero terminated line.
+/// @param time_s The parsed time stamp in seconds.
+/// @param value The parsed value.
+/// @return True if the line holds a sample.
+static bool parse_trace_line(const char* line, double* time_s, double* value) {
+    char* end;
+
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '#' || *line == '\r' || *line == '\n' || *line == '\0') {
+        return false;
+    }
+
+    *time_s = strtod(line, &end);
+    if (end == line) {
+        return false;
+    }
+
+    line = end;
+    while (*line == ' ' || *line == '\t' || *line == ',' || *line == ';') {
+        line++;
+    }
+
+    *value = strtod(line, &end);
+    return end != line;
+}
+
+/// Print an event or compare it against the next event of the golden event stream.
+/// Exits at the first divergent event.
+///
+/// @param sink The event sink.
+/// @param tick The wakeup tick of the event, zero for the header line.
+/// @param event The event line without line ending, NULL at the end of the replay.
+static void emit_event(event_sink_t* sink, uint64_t tick, const char* event) {
+    char golden_line[TRACE_LINE_LENGTH_MAX];
+
+    if (sink->golden == NULL) {
+        if (!sink->quiet && event != NULL) {
+            puts(event);
+        }
+        return;
+    }
+
+    bool golden_valid = false;
+    while (fgets(golden_line, sizeof(golden_line), sink->golden) != NULL) {
+        sink->golden_line_number++;
+        golden_line[strcspn(golden_line, "\r\n")] = '\0';
+        if (golden_line[0] != '#' && golden_line[0] != '\0') {
+            golden_valid = true;
+            break;
+        }
+    }
+
+    if (!golden_valid && event == NULL) {
+        return;
+    }
+
+    if (!golden_valid || event == NULL || strcmp(golden_line, event) != 0) {
+        fprintf(stderr, "First divergence at tick %llu, golden line %lu:\n  expected: %s\n  actual:   %s\n",
+                (unsigned long long)tick, sink->golden_line_number, golden_valid ? golden_line : "<end of stream>",
+                (event != NULL) ? event : "<end of stream>");
+        exit(1);
+    }
+}
+
+/// Print the usage and exit.
+static void print_usage(void) {
+    fprintf(stderr,
+            "Usage: trace_replay [options] trace.csv\n"
+            "  --24v               24V jumper setting (default: 12V)\n"
+            "  --undervoltage-only Feature jumper set to undervoltage protection only\n"
+            "  --calibration HZ    Clock calibration value stored in the eeprom\n"
+            "  --clock HZ          Actual frequency of the sleep clock (default: 128000)\n"
+            "  --raw               The trace holds raw 10 bit adc values instead of volts\n"
+            "  --measurements      Also report every battery measurement as event\n"
+            "  --quiet             Only print the summary\n"
+            "  --compare FILE      Compare the events against a golden event stream\n");
+    exit(2);
+}
+
+/// Parse the command line.
+///
+/// @param argc The argument count.
+/// @param argv The arguments.
+/// @param options The parsed options.
+static void parse_options(int argc, char** argv, replay_options_t* options) {
+    options->_12_24V_selection = true;
+    options->all_features_activated = true;
+    options->clock_calibration_present = false;
+    options->clock_calibration = 0u;
+    options->sleep_clock_hz = (double)SLEEP_CLOCK_VALUE_HZ;
+    options->raw_adc_values = false;
+    options->measurement_events = false;
+    options->quiet = false;
+    options->golden_filename = NULL;
+    options->trace_filename = NULL;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--24v") == 0) {
+            options->_12_24V_selection = false;
+        } else if (strcmp(argv[arg], "--12v") == 0) {
+            options->_12_24V_selection = true;
+        } else if (strcmp(argv[arg], "--undervoltage-only") == 0) {
+            options->all_features_activated = false;
+        } else if (strcmp(argv[arg], "--calibration") == 0 && (arg + 1) < argc) {
+            options->clock_calibration_present = true;
+            options->clock_calibration = (uint32_t)strtoul(argv[++arg], NULL, 0);
+        } else if (strcmp(argv[arg], "--clock") == 0 && (arg + 1) < argc) {
+            options->sleep_clock_hz = strtod(argv[++arg], NULL);
+        } else if (strcmp(argv[arg], "--raw") == 0) {
+            options->raw_adc_values = true;
+        } else if (strcmp(argv[arg], "--measurements") == 0) {
+            options->measurement_events = true;
+        } else if (strcmp(argv[arg], "--quiet") == 0) {
+            options->quiet = true;
+        } else if (strcmp(argv[arg], "--compare") == 0 && (arg + 1) < argc) {
+            options->golden_filename = argv[++arg];
+        } else if (argv[arg][0] != '-' || strcmp(argv[arg], "-") == 0) {
+            options->trace_filename = argv[arg];
+        } else {
+            print_usage();
+        }
+    }
+
+    if (options->trace_filename == NULL || options->sleep_clock_hz <= 0.0) {
+        print_usage();
+    }
+}
+
+int main(int argc, char** argv) {
+    replay_options_t options;
+    parse_options(argc, argv, &options);
+
+    FILE* trace = (strcmp(options.trace_filename, "-") == 0) ? stdin : fopen(options.trace_filename, "r");
+    if (trace == NULL) {
+        perror(options.trace_filename);
+        return 2;
+    }
+
+    event_sink_t sink;
+    sink.quiet = options.quiet;
+    sink.golden = NULL;
+    sink.golden_line_number = 0u;
+    if (options.golden_filename != NULL) {
+        sink.golden = fopen(options.golden_filename, "r");
+        if (sink.golden == NULL) {
+            perror(options.golden_filename);
+            return 2;
+        }
+    }
+
+    time_switch_config_t config;
+    time_switch_state_t state;
+    time_switch_parameters_t parameters;
+    time_switch_default_parameters(&parameters);
+    time_switch_configure(&config, &parameters, options.all_features_activated, options._12_24V_selection,
+                          options.clock_calibration_present, options.clock_calibration);
+    time_switch_init(&state);
+
+    const double wakeup_period_s = (double)SLEEP_CLOCK_CYCLES_PER_WAKEUP / options.sleep_clock_hz;
+    uint64_t tick = 0u;
+    uint64_t measurement_count = 0u;
+    uint64_t load_on_ticks = 0u;
+    uint64_t load_on_count = 0u;
+    uint64_t load_off_count = 0u;
+    uint64_t trip_tick = 0u;
+    uint16_t battery_voltage = 0u;
+    unsigned long line_number = 0u;
+    unsigned long trip_line_number = 0u;
+    unsigned long sample_line_number = 0u;
+    bool sample_valid = false;
+    char line[TRACE_LINE_LENGTH_MAX];
+    char event[TRACE_LINE_LENGTH_MAX];
+    clock_t replay_start = clock();
+
+    emit_event(&sink, 0u, "tick,time_s,event,adc");
+
+    while (fgets(line, sizeof(line), trace) != NULL) {
+        double time_s;
+        double value;
+        line_number++;
+
+        if (!parse_trace_line(line, &time_s, &value)) {
+            continue;
+        }
+        if (options.raw_adc_values && !raw_adc_value_valid(value)) {
+            fprintf(stderr, "%s:%lu: raw value %g is not an adc value (0..%u).\n", options.trace_filename, line_number,
+                    value, TRACE_ADC_MAX);
+            return 2;
+        }
+
+        // Run all wakeups up to the time stamp of the new sample with the previous sample held.
+        if (sample_valid) {
+            uint64_t tick_end = (time_s > 0.0) ? (uint64_t)(time_s / wakeup_period_s) : 0u;
+
+            for (; tick < tick_end; tick++) {
+                bool load_enabled = state.load_enabled;
+
+                if (time_switch_wakeup(&state)) {
+                    measurement_count++;
+                    time_switch_battery_measured(&state, &config, battery_voltage);
+
+                    if (options.measurement_events) {
+                        snprintf(event, sizeof(event), "%llu,%.3f,measurement,%u", (unsigned long long)(tick + 1u),
+                                 (tick + 1u) * wakeup_period_s, (unsigned)battery_voltage);
+                        emit_event(&sink, tick + 1u, event);
+                    }
+
+                    if (state.undervoltage_protection_triggered && trip_tick == 0u) {
+                        trip_tick = tick + 1u;
+                        trip_line_number = sample_line_number;
+                    }
+                }
+
+                time_switch_update_load_timing(&state, &config);
+                load_on_ticks += state.load_enabled ? 1u : 0u;
+
+                if (state.load_enabled != load_enabled) {
+                    load_on_count += state.load_enabled ? 1u : 0u;
+                    load_off_count += state.load_enabled ? 0u : 1u;
+
+                    const char* event_name = state.load_enabled ? "load_on"
+                                             : state.undervoltage_protection_triggered ? "undervoltage_trip"
+                                                                                      : "load_off";
+                    snprintf(event, sizeof(event), "%llu,%.3f,%s,%u", (unsigned long long)(tick + 1u),
+                             (tick + 1u) * wakeup_period_s, event_name, (unsigned)battery_voltage);
+                    emit_event(&sink, tick + 1u, event);
+                }
+            }
+        }
+
+        battery_voltage = options.raw_adc_values ? (uint16_t)value
+                                                 : battery_voltage_to_adc(value, options._12_24V_selection);
+        sample_line_number = line_number;
+        sample_valid = true;
+    }
+
+    double replay_duration_s = (double)(clock() - replay_start) / CLOCKS_PER_SEC;
+
+    // The golden event stream must not hold any further events.
+    emit_event(&sink, tick, NULL);
+
+    if (trace != stdin) {
+        fclose(trace);
+    }
+    if (sink.golden != NULL) {
+        fclose(sink.golden);
+        fprintf(stderr, "Events match the golden event stream '%s'.\n", options.golden_filename);
+    }
+
+    fprintf(stderr, "Configuration:   %s, %s, load on/off %u/%u wakeups, threshold %u\n",
+            options._12_24V_selection ? "12V" : "24V",
+            options.all_features_activated ? "all features" : "undervoltage protection only",
+            (unsigned)config.timing_cycles_load_on, (unsigned)config.timing_cycles_load_off,
+            (unsigned)config.undervoltage_adc_threshold);
+    fprintf(stderr, "Wakeups:         %llu (%.1f days)\n", (unsigned long long)tick, tick * wakeup_period_s / 86400.0);
+    fprintf(stderr, "Measurements:    %llu\n", (unsigned long long)measurement_count);
+    fprintf(stderr, "Load on/off:     %llu/%llu, on for %.1f%% of the time\n", (unsigned long long)load_on_count,
+            (unsigned long long)load_off_count, (tick > 0u) ? (100.0 * load_on_ticks / tick) : 0.0);
+
+    if (trip_tick != 0u) {
+        fprintf(stderr, "Undervoltage:    load cut at tick %llu (%.3f s), trace line %lu\n",
+                (unsigned long long)trip_tick, trip_tick * wakeup_period_s, trip_line_number);
+    } else {
+        fprintf(stderr, "Undervoltage:    not triggered\n");
+    }
+
+    if (replay_duration_s > 0.0) {
+        fprintf(stderr, "Replay speed:    %.3g wakeups/s\n", tick / replay_duration_s);
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+# Synthetic supply voltage traces for tools/trace_replay.cpp.
+#
+# Writes every trace twice, for a 12V battery (<name>_12v.csv) and for a 24V battery (<name>_24v.csv, twice the
+# voltage), into the folder of this script. The traces are deterministic, rerunning the script reproduces the
+# committed files byte by byte. Run it from any folder:
+#   python tools/traces/generate_traces.py
+#
+# The traces (voltages of the 12V variant):
+#   slow_discharge   12.7V resting battery without charging, drained by the load over 7 days down to 9.7V.
+#   load_sag         A pump switching on every 3h for 20min sags the battery by 1.1V, while it discharges over 6 days.
+#   cranking_dip     Engine starts every 8h: 2s crank dip to 7.2V, then 1h of alternator charging. On day 2.5 the
+#                    engine doesn't start, the cranking attempts drain the battery down to 9.6V.
+#   solar_recharge   Deeply discharged battery (10.5V) recharged by a solar panel over 6 days, one cloudy day.
+#                    Stays above the undervoltage threshold, the load keeps switching.
+import math
+import os
+
+# Seconds per day.
+day_s = 86400
+
+# The 24V variant of a trace is the 12V one scaled by this factor.
+scale_24v = 2.0
+
+# The undervoltage thresholds of the firmware in volts (ADC_BATTERY_THRESHOLD_12v/24v), only for the summary.
+threshold_12v = 10.01
+
+
+def slow_discharge():
+    duration_s = 7 * day_s
+    for time_s in range(0, duration_s + 1, 600):
+        x = time_s / duration_s
+        # Flat plateau, steep knee at the end, small daily temperature ripple.
+        voltage = 12.7 - 1.2 * x - 1.8 * x ** 8 + 0.05 * math.sin(2.0 * math.pi * time_s / day_s)
+        yield time_s, voltage
+
+
+def load_sag():
+    duration_s = 6 * day_s
+    period_s = 3 * 3600
+    step_s = 20 * 60
+    for time_s in range(0, duration_s + 1, 120):
+        rest = 12.2 - 0.22 * time_s / day_s
+        phase_s = time_s % period_s
+        if phase_s < step_s:
+            # Immediate sag, partly recovering while the pump runs.
+            voltage = rest - 1.1 + 0.3 * (1.0 - math.exp(-phase_s / 300.0))
+        else:
+            # The surface charge recovers after the pump stopped.
+            voltage = rest - 0.2 * math.exp(-(phase_s - step_s) / 600.0)
+        yield time_s, voltage
+
+
+def cranking_dip():
+    duration_s = 4 * day_s
+    failure_s = int(2.5 * day_s)
+    time_s = 0
+    start_s = 8 * 3600
+    while time_s <= duration_s:
+        rest = 12.5 - 0.1 * time_s / day_s
+        if time_s >= failure_s:
+            # Failed start: three long cranking attempts, then the battery never recovers.
+            attempt = (time_s - failure_s) // 60
+            in_attempt = (time_s - failure_s) % 60
+            if attempt < 3 and in_attempt < 10:
+                voltage = 7.8 + 0.3 * attempt
+            else:
+                voltage = max(9.6, rest - 2.4 * (1.0 - math.exp(-(time_s - failure_s) / 1800.0)))
+            yield time_s, voltage
+            time_s += 1 if time_s < failure_s + 180 else 300
+            continue
+        # The first start 2h into the trace.
+        since_start_s = (time_s + start_s - 2 * 3600) % start_s
+        if since_start_s < 2:
+            voltage = 7.2
+            step_s = 1
+        elif since_start_s < 3:
+            voltage = 10.8
+            step_s = 1
+        elif since_start_s < 3600:
+            voltage = 14.2
+            step_s = 1 if since_start_s < 10 else 300
+        else:
+            voltage = rest
+            step_s = min(300, start_s - since_start_s)
+        yield time_s, voltage
+        time_s += step_s
+
+
+def solar_recharge():
+    duration_s = 6 * day_s
+    for time_s in range(0, duration_s + 1, 300):
+        day = time_s // day_s
+        hour = (time_s % day_s) / 3600.0
+        rest = min(12.8, 10.5 + 0.35 * time_s / day_s)
+        sun = math.sin(math.pi * (hour - 6.0) / 12.0) if 6.0 <= hour < 18.0 else 0.0
+        if day == 2:
+            sun *= 0.3
+        # Charging raises the voltage up to the absorption limit, the load drains it a little over night.
+        voltage = min(14.4, rest + 1.6 * sun) if sun > 0.0 else rest - 0.3
+        yield time_s, voltage
+
+
+traces = {
+    "slow_discharge": slow_discharge,
+    "load_sag": load_sag,
+    "cranking_dip": cranking_dip,
+    "solar_recharge": solar_recharge,
+}
+
+
+def write_trace(path, name, scale, samples):
+    with open(path, "w", newline="\r\n") as f_handle:
+        f_handle.write(f"# {name}, {'24V' if scale != 1.0 else '12V'} battery, generated by tools/traces/generate_traces.py.\n")
+        f_handle.write("time_s,voltage_v\n")
+        for time_s, voltage in samples:
+            f_handle.write(f"{time_s},{voltage * scale:.3f}\n")
+
+
+def main():
+    folder = os.path.dirname(os.path.abspath(__file__))
+    for name, generator in traces.items():
+        samples = list(generator())
+        lowest = min(voltage for _, voltage in samples)
+        for suffix, scale in (("12v", 1.0), ("24v", scale_24v)):
+            write_trace(os.path.join(folder, f"{name}_{suffix}.csv"), name, scale, samples)
+        print(f"{name}: {len(samples)} samples over {samples[-1][0] / day_s:.1f} days, lowest {lowest:.2f}V "
+              f"({'below' if lowest < threshold_12v else 'above'} the 12V threshold)")
+
+
+if __name__ == "__main__":
+    main()